@@ -70,6 +70,18 @@ def benchmark_smutex(task):
         os.system(cmd)
 
 
+# 和cosmutex、rcu一样只有一个写者
+def benchmark_cobrlock(task):
+    os.system("mkdir -p res/cobrlock")
+    base_cmd = "sudo ./build/benchmarks/colocking_benchmarks -t brlock -r {0} -w 1 -c {1} > res/cobrlock/task_{0}_{2}.txt"
+    core = task
+    if core >= 12:
+        core = 12
+    for iter in range(3):
+        cmd = base_cmd.format(task, core, iter)
+        os.system(cmd)
+
+
 def benchmark_rcu(task):
     os.system("mkdir -p res/rcu")
     base_cmd = "sudo ./build/benchmarks/colocking_benchmarks -t rcu -r {0} -w 0 -c {1} -i 100000 > res/rcu/task_{0}_{2}.txt"
@@ -91,4 +103,5 @@ if __name__ == "__main__":
         # benchmark_cospinlock(task)
         # benchmark_smutex(task)
         benchmark_cosmutex(task)
+        # benchmark_cobrlock(task)
         task = task * 2
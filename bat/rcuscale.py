@@ -0,0 +1,39 @@
+import os
+import re
+import sys
+
+
+# RCU读端扩展性：从1个核扫到所有核（双路机器上会跨越两个NUMA节点）
+def benchmark_rcuscale(core, iter):
+    os.system("mkdir -p res/rcuscale")
+    base_cmd = "sudo ./build/benchmarks/rcuscale_benchmarks -c {0} -d 3 > res/rcuscale/core_{0}_{1}.txt"
+    os.system(base_cmd.format(core, iter))
+
+
+def process_file(filename):
+    f = open(filename, "r")
+    for line in f.readlines():
+        m = re.search(r"read_ops: ([0-9.]+)", line)
+        if m and line.startswith("cores"):
+            return float(m.group(1))
+    return 0.0
+
+
+if __name__ == "__main__":
+    max_core = os.cpu_count()
+    if len(sys.argv) > 1:
+        max_core = int(sys.argv[1])
+    f = open("./res/rcuscale.csv", "w")
+    f.write("cores,read_ops,per_core_read_ops\n")
+    core = 1
+    while True:
+        v = 0.0
+        for iter in range(3):
+            benchmark_rcuscale(core, iter)
+            v += process_file("res/rcuscale/core_{0}_{1}.txt".format(core, iter))
+        v /= 3
+        f.write("{0},{1},{2}\n".format(core, v, v / core))
+        if core == max_core:
+            break
+        core = min(core * 2, max_core)
+    f.close()
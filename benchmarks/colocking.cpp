@@ -15,9 +15,12 @@
 #include "rcu.hpp"
 #include "mutex.hpp"
 #include "sharedmutex.hpp"
+#include "brlock.hpp"
+#include "latch.hpp"
 
-enum LockType { Mutex, SpinLock, RwLock, RCU };
-std::vector<std::string> locktypes = {"mutex", "spinlock", "rwlock", "rcu"};
+enum LockType { Mutex, SpinLock, RwLock, RCU, QSpinLock, BrLock };
+std::vector<std::string> locktypes = {"mutex", "spinlock", "rwlock",
+                                      "rcu",   "qspinlock", "brlock"};
 LockType type;
 int num_readers;
 int num_writers;
@@ -28,20 +31,21 @@ std::atomic<uint64_t> read_cnt = 0;
 std::atomic<uint64_t> write_cnt = 0;
 int durations = 1;
 int delay = 0;
+// mutex解锁时直接在解锁线程上恢复等待者，默认在等待者自己的线程上恢复
+bool inline_resume = false;
+
+// 所有协程在这里挂起，等主线程开始计时，不再空转占用reactor
+async_simple::coro::Latch start_latch(1);
 
 static inline void begin_test() {
   ongoing.store(1, std::memory_order_release);
+  start_latch.countDown();
 }
 
 static inline void end_test() {
   ongoing.store(2, std::memory_order_release);
 }
 
-static inline void wait_for_begin() {
-  while (ongoing.load() == 0)
-    ;
-}
-
 struct test_obj {
   int a = 8;
 };
@@ -59,7 +63,7 @@ static inline void delay_sleep() {
 }
 
 task<int> reader(int index, async_simple::coro::Mutex& lock) {
-  wait_for_begin();
+  co_await start_latch.wait();
   int res = 0;
   while (1) {
     co_await lock.coLock();
@@ -75,7 +79,23 @@ task<int> reader(int index, async_simple::coro::Mutex& lock) {
 }
 
 task<int> reader(int index, async_simple::coro::SpinLock& lock) {
-  wait_for_begin();
+  co_await start_latch.wait();
+  int res = 0;
+  while (1) {
+    co_await lock.coLock();
+    assert(gp->a == 8);
+    delay_sleep();
+    lock.unlock();
+    ++res;
+    if (ongoing.load() != 1) [[unlikely]]
+      break;
+  }
+  read_cnt.fetch_add(res, std::memory_order_relaxed);
+  co_return res;
+}
+
+task<int> reader(int index, async_simple::coro::QueuedSpinLock& lock) {
+  co_await start_latch.wait();
   int res = 0;
   while (1) {
     co_await lock.coLock();
@@ -91,7 +111,7 @@ task<int> reader(int index, async_simple::coro::SpinLock& lock) {
 }
 
 task<int> reader(int index, async_simple::coro::SharedMutex& lock) {
-  wait_for_begin();
+  co_await start_latch.wait();
   int res = 0;
   while (1) {
     co_await lock.coLockShared();
@@ -106,8 +126,24 @@ task<int> reader(int index, async_simple::coro::SharedMutex& lock) {
   co_return res;
 }
 
+task<int> reader(int index, async_simple::coro::BrLock& lock) {
+  co_await start_latch.wait();
+  int res = 0;
+  while (1) {
+    co_await lock.coLockShared();
+    assert(gp->a == 8);
+    delay_sleep();
+    lock.unlockShared();
+    ++res;
+    if (ongoing.load() != 1) [[unlikely]]
+      break;
+  }
+  read_cnt.fetch_add(res, std::memory_order_relaxed);
+  co_return res;
+}
+
 task<int> rcureader(int index) {
-  wait_for_begin();
+  co_await start_latch.wait();
   int res = 0;
   while (1) {
     pmss::rcu::rcu_read_lock();
@@ -125,7 +161,7 @@ task<int> rcureader(int index) {
 
 template <typename LockType>
 task<int> writer(int index, LockType& lock) {
-  wait_for_begin();
+  co_await start_latch.wait();
   int res = 0;
   while (1) {
     co_await lock.coLock();
@@ -141,7 +177,7 @@ task<int> writer(int index, LockType& lock) {
 }
 
 task<int> writer(int index, async_simple::coro::SharedMutex& lock) {
-  wait_for_begin();
+  co_await start_latch.wait();
   int res = 0;
   while (1) {
     co_await lock.coLock();
@@ -158,7 +194,7 @@ task<int> writer(int index, async_simple::coro::SharedMutex& lock) {
 
 async_simple::coro::Mutex rcu_mutex;
 task<int> rcuwriter(int index) {
-  wait_for_begin();
+  co_await start_latch.wait();
   int res = 0;
   while (1) {
     co_await rcu_mutex.coLock();
@@ -181,20 +217,27 @@ task<int> rcuwriter(int index) {
 void args_parse(int argc, char** argv) {
   if (argc < 2) {
     fprintf(stderr,
-            "usage: %s -t [mutex/spinlock/sharedmutex/rcu] -r [reader num] "
+            "usage: %s "
+            "-t [mutex/spinlock/qspinlock/sharedmutex/brlock/rcu] "
+            "-r [reader num] "
             "-w [writer num] "
             "-c [core num]"
-            "-d durations(default 1)\n",
+            "-d durations(default 1) "
+            "-l (resume mutex waiters inline)\n",
             argv[0]);
     exit(-1);
   }
 
   int c;
-  while ((c = getopt(argc, argv, "m:t:r:w:d:c:")) != -1) {
+  while ((c = getopt(argc, argv, "m:t:r:w:d:c:l")) != -1) {
     switch (c) {
       case 't':
         if (optarg[0] == 'm') {
           type = Mutex;
+        } else if (optarg[0] == 'q') {
+          type = QSpinLock;
+        } else if (optarg[0] == 'b') {
+          type = BrLock;
         } else if (optarg[0] == 's') {
           if (optarg[1] == 'p')
             type = SpinLock;
@@ -219,12 +262,18 @@ void args_parse(int argc, char** argv) {
       case 'm':
         delay = atoi(optarg);
         break;
+      case 'l':
+        inline_resume = true;
+        break;
       default:
         fprintf(stderr,
-                "usage: %s -t [mutex/spinlock/sharedmutex/rcu] -r [reader num] "
+                "usage: %s "
+                "-t [mutex/spinlock/qspinlock/sharedmutex/brlock/rcu] "
+                "-r [reader num] "
                 "-w [writer num] "
                 "-c [core num]"
-                "-d durations(default 1)\n",
+                "-d durations(default 1) "
+                "-l (resume mutex waiters inline)\n",
                 argv[0]);
         exit(-1);
     }
@@ -232,6 +281,8 @@ void args_parse(int argc, char** argv) {
 
   printf("type: %s\tnum_readers: %d\tnumwriters: %d\tdurations: %d\n",
          locktypes[type].c_str(), num_readers, num_writers, durations);
+  if (type == Mutex)
+    printf("mutex resume: %s\n", inline_resume ? "inline" : "handoff");
 }
 
 // print ops
@@ -245,9 +296,11 @@ void print_result() {
 void benchmark_thread() {
   pmss::init_service(thread_num, "bdev.json", "Malloc0");
 
-  async_simple::coro::Mutex mutex;
+  async_simple::coro::Mutex mutex(!inline_resume);
   async_simple::coro::SharedMutex smutex;
   async_simple::coro::SpinLock spinlock;
+  async_simple::coro::QueuedSpinLock qspinlock;
+  async_simple::coro::BrLock brlock;
 
   while (num_readers + num_writers > 0) {
     if (num_readers > 0) {
@@ -257,6 +310,10 @@ void benchmark_thread() {
         pmss::add_task(reader(num_readers, smutex));
       } else if (type == SpinLock)
         pmss::add_task(reader(num_readers, spinlock));
+      else if (type == QSpinLock)
+        pmss::add_task(reader(num_readers, qspinlock));
+      else if (type == BrLock)
+        pmss::add_task(reader(num_readers, brlock));
       else
         pmss::add_task(rcureader(num_readers));
       --num_readers;
@@ -269,6 +326,10 @@ void benchmark_thread() {
         pmss::add_task(writer(num_writers, smutex));
       else if (type == SpinLock)
         pmss::add_task(writer(num_writers, spinlock));
+      else if (type == QSpinLock)
+        pmss::add_task(writer(num_writers, qspinlock));
+      else if (type == BrLock)
+        pmss::add_task(writer(num_writers, brlock));
       else
         pmss::add_task(rcuwriter(num_writers));
       --num_writers;
@@ -0,0 +1,126 @@
+#include <sys/resource.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <future>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#include "schedule.hpp"
+#include "service.hpp"
+#include "task.hpp"
+
+// 低负载下CPU占用和延迟的对比：常驻服务，外部线程按固定的速率提交读请求，
+// 统计从提交到读完成的延迟，以及这段时间整个进程用掉的CPU（折算成核数）
+// -m poll：一直轮询
+// -m intr：一直是中断模式
+// -m adaptive：中断模式，负载高的核自动切换到轮询模式
+
+enum class Mode { Poll, Intr, Adaptive };
+Mode mode = Mode::Poll;
+int thread_num = 2;
+int rate = 1000;
+int durations = 5;
+
+task<int> request(std::chrono::steady_clock::time_point submit_time,
+                  double* latency_us) {
+  char* buf = (char*)spdk_dma_zmalloc(4096, 4096, nullptr);
+  int rc = co_await pmss::read(buf, 4096, 0);
+  spdk_dma_free(buf);
+  *latency_us = std::chrono::duration<double, std::micro>(
+                    std::chrono::steady_clock::now() - submit_time)
+                    .count();
+  co_return rc;
+}
+
+void args_parse(int argc, char** argv) {
+  int c;
+  while ((c = getopt(argc, argv, "m:c:r:d:")) != -1) {
+    switch (c) {
+      case 'm':
+        if (strcmp(optarg, "poll") == 0) {
+          mode = Mode::Poll;
+        } else if (strcmp(optarg, "intr") == 0) {
+          mode = Mode::Intr;
+        } else if (strcmp(optarg, "adaptive") == 0) {
+          mode = Mode::Adaptive;
+        } else {
+          fprintf(stderr, "unknown mode %s\n", optarg);
+          exit(-1);
+        }
+        break;
+      case 'c':
+        thread_num = atoi(optarg);
+        break;
+      case 'r':
+        rate = atoi(optarg);
+        break;
+      case 'd':
+        durations = atoi(optarg);
+        break;
+      default:
+        fprintf(stderr,
+                "usage: %s -m [poll|intr|adaptive] -c [core num] -r "
+                "[requests per second] -d durations(default 5)\n",
+                argv[0]);
+        exit(-1);
+    }
+  }
+  if (thread_num <= 0 || rate <= 0 || durations <= 0) {
+    fprintf(stderr, "invalid arguments\n");
+    exit(-1);
+  }
+}
+
+double cpu_seconds() {
+  rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+         (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+int main(int argc, char* argv[]) {
+  args_parse(argc, argv);
+  pmss::service_options opts =
+      pmss::default_options(thread_num, "bdev.json", "Malloc0");
+  opts.interrupt_mode = mode != Mode::Poll;
+  if (mode == Mode::Intr)
+    opts.adaptive_period_us = 0;
+  pmss::start_service(opts);
+
+  long total = (long)rate * durations;
+  std::vector<double> latencies(total);
+  std::vector<std::future<int>> futures;
+  futures.reserve(total);
+  auto interval = std::chrono::nanoseconds(1000000000L / rate);
+  double cpu_start = cpu_seconds();
+  auto start = std::chrono::steady_clock::now();
+  auto next = start;
+  for (long i = 0; i < total; ++i) {
+    std::this_thread::sleep_until(next);
+    next += interval;
+    futures.push_back(pmss::submit(
+        request(std::chrono::steady_clock::now(), &latencies[i])));
+  }
+  int errors = 0;
+  for (auto& f : futures)
+    errors += f.get() != 0;
+  double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                              start)
+                    .count();
+  double cpu = cpu_seconds() - cpu_start;
+  pmss::stop_service();
+
+  std::sort(latencies.begin(), latencies.end());
+  const char* names[] = {"poll", "intr", "adaptive"};
+  printf(
+      "mode: %s\tcores: %d\trate: %d\tcpu_cores: %lf\tp50_us: %lf\tp99_us: "
+      "%lf\tswitches: %lu\terrors: %d\n",
+      names[(int)mode], thread_num, rate, cpu / secs,
+      latencies[total / 2], latencies[total * 99 / 100], pmss::mode_switches,
+      errors);
+  return 0;
+}
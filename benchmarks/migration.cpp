@@ -0,0 +1,108 @@
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include <vector>
+#include "schedule.hpp"
+#include "service.hpp"
+#include "task.hpp"
+
+// 负载不均时SPDK调度器迁移spdk_thread的效果：每个核threads_per_core个
+// spdk_thread，只有创建在最后一个核上的那些一直做I/O并且yield，其他的直接结束。
+// 统计总的I/O次数，以及结束时有几个忙的spdk_thread已经不在原来的核上
+// -s static：默认的调度器，从不迁移
+// -s dynamic：SPDK的dynamic调度器，负载高的核把线程分给空闲的核
+
+const char* scheduler = "dynamic";
+int thread_num = 2;
+int threads_per_core = 4;
+int durations = 5;
+
+std::atomic<long> total_ops = 0;
+std::atomic<int> moved = 0;
+
+task<int> skewed(int idx) {
+  uint32_t start = spdk_env_get_current_core();
+  if (start != pmss::reactor_cores.back())
+    co_return 0;
+  char* buf = (char*)spdk_dma_zmalloc(4096, 4096, nullptr);
+  int errors = 0;
+  long ops = 0;
+  auto deadline =
+      std::chrono::steady_clock::now() + std::chrono::seconds(durations);
+  while (std::chrono::steady_clock::now() < deadline) {
+    errors += co_await pmss::write(buf, 4096, idx * 4096) != 0;
+    errors += co_await pmss::read(buf, 4096, idx * 4096) != 0;
+    ops += 2;
+    co_await yield();
+  }
+  spdk_dma_free(buf);
+  total_ops.fetch_add(ops);
+  if (spdk_env_get_current_core() != start)
+    moved.fetch_add(1);
+  co_return errors;
+}
+
+void args_parse(int argc, char** argv) {
+  int c;
+  while ((c = getopt(argc, argv, "s:c:t:d:")) != -1) {
+    switch (c) {
+      case 's':
+        if (strcmp(optarg, "static") != 0 && strcmp(optarg, "dynamic") != 0) {
+          fprintf(stderr, "unknown scheduler %s\n", optarg);
+          exit(-1);
+        }
+        scheduler = optarg;
+        break;
+      case 'c':
+        thread_num = atoi(optarg);
+        break;
+      case 't':
+        threads_per_core = atoi(optarg);
+        break;
+      case 'd':
+        durations = atoi(optarg);
+        break;
+      default:
+        fprintf(stderr,
+                "usage: %s -s [static|dynamic] -c [core num] -t [threads per "
+                "core] -d durations(default 5)\n",
+                argv[0]);
+        exit(-1);
+    }
+  }
+  if (thread_num < 2 || threads_per_core <= 0 || durations <= 0) {
+    fprintf(stderr, "invalid arguments\n");
+    exit(-1);
+  }
+}
+
+int main(int argc, char* argv[]) {
+  args_parse(argc, argv);
+  pmss::service_options opts =
+      pmss::default_options(thread_num, "bdev.json", "Malloc0");
+  opts.threads_per_core = threads_per_core;
+  opts.scheduler = scheduler;
+  pmss::init_service(opts);
+  std::vector<task<int>> ts;
+  for (int i = 0; i < pmss::num_workers; ++i)
+    ts.push_back(skewed(i));
+  auto start = std::chrono::steady_clock::now();
+  auto results = pmss::run_all(ts);
+  double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                              start)
+                    .count();
+  pmss::deinit_service();
+
+  int errors = 0;
+  for (auto& r : results)
+    errors += !r || *r != 0;
+  printf("scheduler: %s\tcores: %d\tthreads_per_core: %d\tmoved: %d\tiops: "
+         "%lf\terrors: %d\n",
+         scheduler, thread_num, threads_per_core, moved.load(),
+         total_ops.load() / secs, errors);
+  return 0;
+}
@@ -0,0 +1,165 @@
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+#include <vector>
+#include "channel.hpp"
+#include "latch.hpp"
+#include "schedule.hpp"
+#include "task.hpp"
+
+// 三级流水线吞吐测试：producer -> filter -> consumer，级与级之间用Channel连接
+// 每个核上各有一个producer、filter和consumer，元素在核之间随意流动
+// -b大于1时filter和consumer用recv_many批量取，对比逐个recv的开销
+
+int thread_num = 1;
+long num_items = 1000000;
+size_t batch = 1;
+size_t capacity = 1024;
+
+async_simple::coro::Channel<uint64_t>* stage1;
+async_simple::coro::Channel<uint64_t>* stage2;
+std::atomic<int> producers_left;
+std::atomic<int> filters_left;
+std::atomic<int> started = 0;
+std::atomic<uint64_t> checksum = 0;
+std::atomic<long> received = 0;
+async_simple::coro::Latch start_latch(1);
+std::chrono::steady_clock::time_point start_time;
+
+task<int> producer(int index) {
+  started.fetch_add(1);
+  co_await start_latch.wait();
+  for (long i = index; i < num_items; i += thread_num)
+    co_await stage1->send((uint64_t)i);
+  if (producers_left.fetch_sub(1) == 1)
+    stage1->close();
+  co_return 0;
+}
+
+task<int> filter(int index) {
+  started.fetch_add(1);
+  co_await start_latch.wait();
+  std::vector<uint64_t> buf(batch);
+  while (true) {
+    size_t n;
+    if (batch > 1) {
+      n = co_await stage1->recv_many(buf.data(), batch);
+    } else {
+      auto v = co_await stage1->recv();
+      n = v ? 1 : 0;
+      if (v)
+        buf[0] = *v;
+    }
+    if (n == 0)
+      break;
+    for (size_t i = 0; i < n; ++i)
+      co_await stage2->send(buf[i] * 2 + 1);
+  }
+  if (filters_left.fetch_sub(1) == 1)
+    stage2->close();
+  co_return 0;
+}
+
+task<int> consumer(int index) {
+  started.fetch_add(1);
+  co_await start_latch.wait();
+  std::vector<uint64_t> buf(batch);
+  uint64_t sum = 0;
+  long cnt = 0;
+  while (true) {
+    size_t n;
+    if (batch > 1) {
+      n = co_await stage2->recv_many(buf.data(), batch);
+    } else {
+      auto v = co_await stage2->recv();
+      n = v ? 1 : 0;
+      if (v)
+        buf[0] = *v;
+    }
+    if (n == 0)
+      break;
+    for (size_t i = 0; i < n; ++i)
+      sum += buf[i];
+    cnt += n;
+  }
+  checksum.fetch_add(sum);
+  received.fetch_add(cnt);
+  co_return 0;
+}
+
+// 等所有协程都开始等待之后再开始计时
+task<int> starter() {
+  while (started.load() < 3 * thread_num)
+    co_await yield();
+  start_time = std::chrono::steady_clock::now();
+  start_latch.countDown();
+  co_return 0;
+}
+
+void args_parse(int argc, char** argv) {
+  int c;
+  while ((c = getopt(argc, argv, "c:n:b:q:")) != -1) {
+    switch (c) {
+      case 'c':
+        thread_num = atoi(optarg);
+        break;
+      case 'n':
+        num_items = atol(optarg);
+        break;
+      case 'b':
+        batch = atol(optarg);
+        break;
+      case 'q':
+        capacity = atol(optarg);
+        break;
+      default:
+        fprintf(stderr,
+                "usage: %s -c [core num] -n [item num] -b [recv batch] -q "
+                "[channel capacity]\n",
+                argv[0]);
+        exit(-1);
+    }
+  }
+  if (thread_num <= 0 || batch == 0 || capacity == 0) {
+    fprintf(stderr, "invalid arguments\n");
+    exit(-1);
+  }
+}
+
+int main(int argc, char* argv[]) {
+  args_parse(argc, argv);
+  stage1 = new async_simple::coro::Channel<uint64_t>(capacity);
+  stage2 = new async_simple::coro::Channel<uint64_t>(capacity);
+  producers_left = thread_num;
+  filters_left = thread_num;
+
+  pmss::init_service(thread_num, "bdev.json", "Malloc0");
+  // 按round robin每个核正好各有一个producer、filter和consumer
+  for (int i = 0; i < thread_num; ++i)
+    pmss::add_task(producer(i));
+  for (int i = 0; i < thread_num; ++i)
+    pmss::add_task(filter(i));
+  for (int i = 0; i < thread_num; ++i)
+    pmss::add_task(consumer(i));
+  pmss::add_task(starter());
+  pmss::run();
+  auto end_time = std::chrono::steady_clock::now();
+  pmss::deinit_service();
+
+  uint64_t expect = 0;
+  for (long i = 0; i < num_items; ++i)
+    expect += (uint64_t)i * 2 + 1;
+  double secs = std::chrono::duration<double>(end_time - start_time).count();
+  printf("cores: %d\tbatch: %zu\tcapacity: %zu\titems: %ld\tops: %lf\t%s\n",
+         thread_num, batch, stage1->capacity(), received.load(),
+         received.load() / secs,
+         (checksum.load() == expect && received.load() == num_items)
+             ? "ok"
+             : "MISMATCH");
+  delete stage1;
+  delete stage2;
+  return 0;
+}
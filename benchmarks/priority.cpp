@@ -0,0 +1,144 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include <vector>
+#include "schedule.hpp"
+#include "service.hpp"
+#include "task.hpp"
+
+// 后台任务（模拟compaction/scrub：不停地读，并且频繁yield）运行时，
+// 前台请求（yield一次再读4K）的延迟。每个核一个前台任务，
+// 每个请求之间sleep一段时间，统计所有请求的p50/p99
+// -p low：后台任务是低优先级（默认）
+// -p high：后台任务和前台一样，相当于没有优先级
+// -b 0：没有后台任务，作为基准
+
+int thread_num = 2;
+int background_per_core = 8;
+int requests = 2000;
+int think_us = 100;
+bool background_low = true;
+int io_depth = 8;
+
+std::atomic<int> foreground_done = 0;
+std::atomic<long> background_ops = 0;
+
+task<int> foreground(double* latency_us) {
+  char* buf = (char*)spdk_dma_zmalloc(4096, 4096, nullptr);
+  int errors = 0;
+  for (int i = 0; i < requests; ++i) {
+    auto start = std::chrono::steady_clock::now();
+    co_await yield();
+    errors += co_await pmss::read(buf, 4096, 0) != 0;
+    latency_us[i] = std::chrono::duration<double, std::micro>(
+                        std::chrono::steady_clock::now() - start)
+                        .count();
+    co_await sleep_for(think_us);
+  }
+  spdk_dma_free(buf);
+  foreground_done.fetch_add(1);
+  co_return errors;
+}
+
+task<int> background(int idx) {
+  char* buf = (char*)spdk_dma_zmalloc(4096, 4096, nullptr);
+  int errors = 0;
+  long ops = 0;
+  for (size_t i = 0; foreground_done.load() < thread_num; ++i) {
+    errors += co_await pmss::read(buf, 4096, ((idx + i) % 1024) * 4096) != 0;
+    // 扫描时每处理一小块就yield一次
+    for (int k = 0; k < 4; ++k)
+      co_await yield();
+    ++ops;
+  }
+  spdk_dma_free(buf);
+  background_ops.fetch_add(ops);
+  co_return errors;
+}
+
+void args_parse(int argc, char** argv) {
+  int c;
+  while ((c = getopt(argc, argv, "c:b:r:t:p:d:")) != -1) {
+    switch (c) {
+      case 'c':
+        thread_num = atoi(optarg);
+        break;
+      case 'b':
+        background_per_core = atoi(optarg);
+        break;
+      case 'r':
+        requests = atoi(optarg);
+        break;
+      case 't':
+        think_us = atoi(optarg);
+        break;
+      case 'p':
+        if (strcmp(optarg, "low") == 0) {
+          background_low = true;
+        } else if (strcmp(optarg, "high") == 0) {
+          background_low = false;
+        } else {
+          fprintf(stderr, "unknown priority %s\n", optarg);
+          exit(-1);
+        }
+        break;
+      case 'd':
+        io_depth = atoi(optarg);
+        break;
+      default:
+        fprintf(stderr,
+                "usage: %s -c [core num] -b [background tasks per core] -r "
+                "[requests per core] -t [think time us] -p [low|high] -d "
+                "[background io depth]\n",
+                argv[0]);
+        exit(-1);
+    }
+  }
+  if (thread_num <= 0 || background_per_core < 0 || requests <= 0 ||
+      think_us < 0 || io_depth <= 0) {
+    fprintf(stderr, "invalid arguments\n");
+    exit(-1);
+  }
+}
+
+int main(int argc, char* argv[]) {
+  args_parse(argc, argv);
+  pmss::service_options opts =
+      pmss::default_options(thread_num, "bdev.json", "Malloc0");
+  opts.background_io_depth = io_depth;
+  pmss::init_service(opts);
+
+  std::vector<double> latencies((size_t)thread_num * requests);
+  std::vector<std::optional<int>> results(thread_num +
+                                          thread_num * background_per_core);
+  // round robin派发：前thread_num个task正好每个核一个
+  for (int i = 0; i < thread_num; ++i)
+    pmss::add_task(foreground(&latencies[(size_t)i * requests]), &results[i]);
+  auto bg = background_low ? pmss::priority::low : pmss::priority::high;
+  for (int i = 0; i < thread_num * background_per_core; ++i)
+    pmss::add_task(background(i).with_priority(bg), &results[thread_num + i]);
+  auto start = std::chrono::steady_clock::now();
+  pmss::run();
+  double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                              start)
+                    .count();
+  pmss::deinit_service();
+
+  int errors = 0;
+  for (auto& r : results)
+    errors += !r || *r != 0;
+  std::sort(latencies.begin(), latencies.end());
+  size_t total = latencies.size();
+  printf(
+      "cores: %d\tbackground: %d\tpriority: %s\tp50_us: %lf\tp99_us: "
+      "%lf\tbackground_ops: %lf\terrors: %d\n",
+      thread_num, background_per_core, background_low ? "low" : "high",
+      latencies[total / 2], latencies[total * 99 / 100],
+      background_ops.load() / secs, errors);
+  return 0;
+}
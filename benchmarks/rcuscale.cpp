@@ -0,0 +1,133 @@
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#include "latch.hpp"
+#include "rcu.hpp"
+#include "schedule.hpp"
+#include "task.hpp"
+
+// RCU读端扩展性测试：每个核一个读者，统计每个核以及总的读吞吐
+// 配合bat/rcuscale.py从1个核一直扫到双路机器的全部核
+
+int thread_num = 1;
+int durations = 1;
+int num_writers = 0;
+std::atomic<int> ongoing = 0;
+
+struct alignas(64) per_core_count {
+  uint64_t reads;
+};
+// 按spdk_thread的编号索引
+std::vector<per_core_count> counts;
+std::atomic<uint64_t> write_cnt = 0;
+
+struct test_obj {
+  int a = 8;
+};
+
+test_obj rcu_data[2];
+test_obj* gp = &rcu_data[0];
+
+// 所有协程在这里挂起，等主线程开始计时
+async_simple::coro::Latch start_latch(1);
+
+task<int> rcureader(int index) {
+  co_await start_latch.wait();
+  uint64_t res = 0;
+  while (1) {
+    pmss::rcu::rcu_read_lock();
+    test_obj* p = pmss::rcu::rcu_dereference(gp);
+    assert(p->a == 8);
+    pmss::rcu::rcu_read_unlock();
+    ++res;
+    // 定期检查，避免每次读都去访问共享的ongoing
+    if ((res & 1023) == 0 && ongoing.load(std::memory_order_relaxed) != 1)
+        [[unlikely]]
+      break;
+  }
+  counts[pmss::worker_index()].reads = res;
+  co_return 0;
+}
+
+task<int> rcuwriter(int index) {
+  co_await start_latch.wait();
+  int cur = 0;
+  uint64_t res = 0;
+  while (ongoing.load(std::memory_order_relaxed) == 1) {
+    cur = !cur;
+    rcu_data[cur].a = 8;
+    pmss::rcu::rcu_assign_pointer(gp, &rcu_data[cur]);
+    co_await pmss::rcu::synchronize_rcu();
+    ++res;
+  }
+  write_cnt.fetch_add(res, std::memory_order_relaxed);
+  co_return 0;
+}
+
+void args_parse(int argc, char** argv) {
+  int c;
+  while ((c = getopt(argc, argv, "c:d:w:")) != -1) {
+    switch (c) {
+      case 'c':
+        thread_num = atoi(optarg);
+        break;
+      case 'd':
+        durations = atoi(optarg);
+        break;
+      case 'w':
+        num_writers = atoi(optarg);
+        break;
+      default:
+        fprintf(stderr,
+                "usage: %s -c [core num] -w [writer num] -d durations(default "
+                "1)\n",
+                argv[0]);
+        exit(-1);
+    }
+  }
+  if (thread_num <= 0) {
+    fprintf(stderr, "core num must be positive\n");
+    exit(-1);
+  }
+}
+
+void print_result() {
+  uint64_t total = 0;
+  for (int i = 0; i < thread_num; ++i) {
+    printf("core %d: %lf\n", i, counts[i].reads / (double)durations);
+    total += counts[i].reads;
+  }
+  printf("cores: %d\tread_ops: %lf\tper_core_read_ops: %lf\twrite_ops: %lf\n",
+         thread_num, total / (double)durations,
+         total / (double)durations / thread_num,
+         write_cnt / (double)durations);
+}
+
+void benchmark_thread() {
+  pmss::init_service(thread_num, "bdev.json", "Malloc0");
+  counts.resize(thread_num);
+  // 读者按round robin正好每个核一个
+  for (int i = 0; i < thread_num; ++i)
+    pmss::add_task(rcureader(i));
+  for (int i = 0; i < num_writers; ++i)
+    pmss::add_task(rcuwriter(i));
+  pmss::run();
+  print_result();
+  pmss::deinit_service();
+}
+
+int main(int argc, char* argv[]) {
+  args_parse(argc, argv);
+  std::thread t(benchmark_thread);
+  sleep(1);
+  ongoing.store(1, std::memory_order_release);
+  start_latch.countDown();
+  sleep(durations);
+  ongoing.store(2, std::memory_order_release);
+  t.join();
+  return 0;
+}
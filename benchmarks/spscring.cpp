@@ -0,0 +1,137 @@
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include "latch.hpp"
+#include "schedule.hpp"
+#include "spscring.hpp"
+#include "task.hpp"
+
+// 两个reactor之间一对一传递的吞吐测试
+// -m ring：SpscRing，消费者co_await pop()
+// -m msg：每个元素一次spdk_thread_send_msg，作为对比
+
+enum class Mode { Ring, Msg };
+Mode mode = Mode::Ring;
+long num_items = 10000000;
+size_t batch = 16;
+size_t capacity = 65536;
+
+async_simple::coro::SpscRing<uint64_t>* ring;
+async_simple::coro::Latch start_latch(1);
+std::atomic<int> started = 0;
+std::atomic<spdk_thread*> consumer_thread = nullptr;
+std::chrono::steady_clock::time_point start_time;
+std::chrono::steady_clock::time_point end_time;
+// 只在消费者的线程上访问
+uint64_t checksum = 0;
+long received = 0;
+
+void on_msg(void* ctx) {
+  checksum += (uint64_t)ctx;
+  ++received;
+}
+
+task<int> producer() {
+  started.fetch_add(1);
+  co_await start_latch.wait();
+  if (mode == Mode::Ring) {
+    for (long i = 0; i < num_items; ++i) {
+      while (!ring->tryEmplace((uint64_t)i))
+        co_await yield();
+    }
+    ring->close();
+  } else {
+    spdk_thread* t = consumer_thread.load();
+    for (long i = 0; i < num_items; ++i) {
+      // 消息池用完时让出reactor，等消费者处理掉一些
+      while (spdk_thread_send_msg(t, on_msg, (void*)i) != 0)
+        co_await yield();
+    }
+  }
+  co_return 0;
+}
+
+task<int> consumer() {
+  consumer_thread.store(spdk_get_thread());
+  started.fetch_add(1);
+  co_await start_latch.wait();
+  if (mode == Mode::Ring) {
+    while (auto v = co_await ring->pop()) {
+      checksum += *v;
+      ++received;
+    }
+  } else {
+    while (received < num_items)
+      co_await yield();
+  }
+  end_time = std::chrono::steady_clock::now();
+  co_return 0;
+}
+
+// 等生产者和消费者都开始等待之后再开始计时
+task<int> starter() {
+  while (started.load() < 2)
+    co_await yield();
+  start_time = std::chrono::steady_clock::now();
+  start_latch.countDown();
+  co_return 0;
+}
+
+void args_parse(int argc, char** argv) {
+  int c;
+  while ((c = getopt(argc, argv, "m:n:b:q:")) != -1) {
+    switch (c) {
+      case 'm':
+        if (strcmp(optarg, "ring") == 0) {
+          mode = Mode::Ring;
+        } else if (strcmp(optarg, "msg") == 0) {
+          mode = Mode::Msg;
+        } else {
+          fprintf(stderr, "unknown mode %s\n", optarg);
+          exit(-1);
+        }
+        break;
+      case 'n':
+        num_items = atol(optarg);
+        break;
+      case 'b':
+        batch = atol(optarg);
+        break;
+      case 'q':
+        capacity = atol(optarg);
+        break;
+      default:
+        fprintf(stderr,
+                "usage: %s -m [ring|msg] -n [item num] -b [publish batch] -q "
+                "[ring capacity]\n",
+                argv[0]);
+        exit(-1);
+    }
+  }
+}
+
+int main(int argc, char* argv[]) {
+  args_parse(argc, argv);
+  ring = new async_simple::coro::SpscRing<uint64_t>(capacity, batch);
+
+  pmss::init_service(2, "bdev.json", "Malloc0");
+  // round robin，生产者在核0，消费者在核1
+  pmss::add_task(producer());
+  pmss::add_task(consumer());
+  pmss::add_task(starter());
+  pmss::run();
+  pmss::deinit_service();
+
+  uint64_t expect = (uint64_t)num_items * (num_items - 1) / 2;
+  double secs = std::chrono::duration<double>(end_time - start_time).count();
+  printf("mode: %s\tbatch: %zu\titems: %ld\tops: %lf\t%s\n",
+         mode == Mode::Ring ? "ring" : "msg", batch, received,
+         received / secs,
+         (checksum == expect && received == num_items) ? "ok" : "MISMATCH");
+  delete ring;
+  return 0;
+}
@@ -1,5 +1,13 @@
-#ifndef RCU_LIST_H
-#define RCU_LIST_H
+#ifndef LIST_H
+#define LIST_H
+#include <cstddef>
+
+#define caa_container_of(ptr, type, member) \
+  ((type*)((char*)(ptr)-offsetof(type, member)))
+
+/* Initialize a new list head. */
+#define CDS_INIT_LIST_HEAD(ptr) (ptr)->next = (ptr)->prev = (ptr)
+
 struct ListNode {
   ListNode* next;
   ListNode* prev;
@@ -129,7 +137,7 @@ static inline void cds_list_replace_init(struct ListNode* old,
   struct ListNode* head = old->next;
 
   cds_list_del(old);
-  cds_list_add_tail(_new, head);
+  list_add_tail(_new, head);
   CDS_INIT_LIST_HEAD(old);
 }
 
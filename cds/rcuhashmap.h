@@ -0,0 +1,341 @@
+#ifndef RCU_HASHMAP_H
+#define RCU_HASHMAP_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <utility>
+#include "rcu.hpp"
+#include "spinlock.hpp"
+#include "task.hpp"
+
+namespace pmss {
+namespace cds {
+
+// RCU保护的并发哈希表
+//
+// 读者：find/visit只在rcu读端临界区内遍历桶链表，不加锁也不写共享内存
+// 写者：按hash取一把协程锁（锁分段），节点通过call_rcu延迟回收
+// 扩容：负载超过max_load之后新建一张两倍大小的表，之后每次写操作顺带迁移几个桶。
+//      迁移时把旧桶里的节点复制到新表，发布新链表之后再给旧桶打上migrated标记，
+//      读者看到标记就去新表查找，所以整个过程读者都不会被阻塞。
+//
+// 锁的个数固定为min(初始桶数, max_stripes)，表只会变大，
+// 所以一个桶以及它迁移之后对应的两个新桶总是落在同一把锁上。
+// 写者拿到锁之后到解锁之前都不会挂起，因此拿到的表指针在这段时间内不会被回收。
+template <typename Key, typename Value, typename Hash = std::hash<Key>,
+          typename KeyEqual = std::equal_to<Key>,
+          typename Lock = async_simple::coro::SpinLock>
+class RcuHashMap {
+  struct node {
+    // 必须是第一个成员，回调里直接把rcu_head转换回node
+    rcu::rcu_head rcu;
+    node* next;
+    size_t hash;
+    Key key;
+    Value value;
+  };
+
+  struct bucket {
+    node* head;
+    std::atomic<bool> migrated;
+  };
+
+  struct table {
+    rcu::rcu_head rcu;
+    size_t mask;
+    bucket* buckets;
+    // 正在迁移的目标表
+    std::atomic<table*> next;
+    // 下一个待迁移的桶
+    std::atomic<size_t> cursor;
+    // 已经迁移完成的桶数
+    std::atomic<size_t> migrated;
+  };
+
+  struct alignas(64) stripe {
+    Lock lock;
+  };
+
+ public:
+  static constexpr size_t max_stripes = 4096;
+  // 每次写操作顺带迁移的桶数
+  static constexpr int migrate_batch = 2;
+
+  explicit RcuHashMap(size_t initial_buckets = 1024, size_t max_load = 4)
+      : _max_load(max_load), _size(0) {
+    size_t n = 1;
+    while (n < initial_buckets)
+      n <<= 1;
+    _table = alloc_table(n);
+    _num_stripes = std::min(n, max_stripes);
+    _stripes = new stripe[_num_stripes];
+  }
+
+  RcuHashMap(const RcuHashMap&) = delete;
+  RcuHashMap& operator=(const RcuHashMap&) = delete;
+
+  // 调用者需要保证此时没有并发的读者和写者
+  ~RcuHashMap() {
+    table* t = _table;
+    table* nt = t->next.load(std::memory_order_relaxed);
+    for (size_t i = 0; i <= t->mask; ++i) {
+      if (!t->buckets[i].migrated.load(std::memory_order_relaxed))
+        free_chain(t->buckets[i].head);
+    }
+    free_table(t);
+    if (nt) {
+      for (size_t i = 0; i <= nt->mask; ++i)
+        free_chain(nt->buckets[i].head);
+      free_table(nt);
+    }
+    delete[] _stripes;
+  }
+
+  // 查找成功时把value拷贝到out
+  bool find(const Key& key, Value& out) {
+    return visit(key, [&](const Value& v) { out = v; });
+  }
+
+  bool contains(const Key& key) {
+    return visit(key, [](const Value&) {});
+  }
+
+  // 在读端临界区内对value调用f，f不能挂起
+  template <typename F>
+  bool visit(const Key& key, F&& f) {
+    size_t h = _hasher(key);
+    rcu::rcu_read_lock();
+    node* n = lookup(locate(h), h, key);
+    if (n)
+      f(static_cast<const Value&>(n->value));
+    rcu::rcu_read_unlock();
+    return n != nullptr;
+  }
+
+  // key已经存在时返回false
+  task<bool> insert(const Key& key, const Value& value) {
+    size_t h = _hasher(key);
+    Lock& lock = stripe_of(h);
+    co_await lock.coLock();
+    rcu::rcu_read_lock();
+    bucket* b = locate(h);
+    bool inserted = lookup(b, h, key) == nullptr;
+    if (inserted) {
+      node* n = new node{{}, b->head, h, key, value};
+      rcu::rcu_assign_pointer(b->head, n);
+      maybe_grow(_size.fetch_add(1, std::memory_order_relaxed) + 1);
+    }
+    rcu::rcu_read_unlock();
+    lock.unlock();
+    co_await migrate();
+    co_return inserted;
+  }
+
+  // key已经存在时用新节点替换旧节点，旧节点在宽限期之后回收
+  task<bool> insert_or_assign(const Key& key, const Value& value) {
+    size_t h = _hasher(key);
+    Lock& lock = stripe_of(h);
+    co_await lock.coLock();
+    rcu::rcu_read_lock();
+    bucket* b = locate(h);
+    node** prev = find_prev(b, h, key);
+    bool inserted = *prev == nullptr;
+    if (inserted) {
+      node* n = new node{{}, b->head, h, key, value};
+      rcu::rcu_assign_pointer(b->head, n);
+      maybe_grow(_size.fetch_add(1, std::memory_order_relaxed) + 1);
+    } else {
+      node* old = *prev;
+      node* n = new node{{}, old->next, h, key, value};
+      rcu::rcu_assign_pointer(*prev, n);
+      rcu::call_rcu(&old->rcu, free_node);
+    }
+    rcu::rcu_read_unlock();
+    lock.unlock();
+    co_await migrate();
+    co_return inserted;
+  }
+
+  task<bool> erase(const Key& key) {
+    size_t h = _hasher(key);
+    Lock& lock = stripe_of(h);
+    co_await lock.coLock();
+    rcu::rcu_read_lock();
+    node** prev = find_prev(locate(h), h, key);
+    node* victim = *prev;
+    if (victim) {
+      rcu::rcu_assign_pointer(*prev, victim->next);
+      rcu::call_rcu(&victim->rcu, free_node);
+      _size.fetch_sub(1, std::memory_order_relaxed);
+    }
+    rcu::rcu_read_unlock();
+    lock.unlock();
+    co_await migrate();
+    co_return victim != nullptr;
+  }
+
+  // 把正在进行的扩容迁移完
+  task<void> finish_resize() {
+    while (resizing())
+      co_await migrate();
+  }
+
+  bool resizing() {
+    rcu::rcu_read_lock();
+    table* t = rcu::rcu_dereference(_table);
+    bool ret = t->next.load(std::memory_order_acquire) != nullptr;
+    rcu::rcu_read_unlock();
+    return ret;
+  }
+
+  size_t size() const { return _size.load(std::memory_order_relaxed); }
+
+  size_t bucket_count() {
+    rcu::rcu_read_lock();
+    size_t n = rcu::rcu_dereference(_table)->mask + 1;
+    rcu::rcu_read_unlock();
+    return n;
+  }
+
+ private:
+  static table* alloc_table(size_t n) {
+    table* t = new table;
+    t->mask = n - 1;
+    t->buckets = new bucket[n];
+    for (size_t i = 0; i < n; ++i) {
+      t->buckets[i].head = nullptr;
+      t->buckets[i].migrated.store(false, std::memory_order_relaxed);
+    }
+    t->next.store(nullptr, std::memory_order_relaxed);
+    t->cursor.store(0, std::memory_order_relaxed);
+    t->migrated.store(0, std::memory_order_relaxed);
+    return t;
+  }
+
+  static void free_table(table* t) {
+    delete[] t->buckets;
+    delete t;
+  }
+
+  static void free_table_rcu(rcu::rcu_head* head) {
+    free_table(reinterpret_cast<table*>(head));
+  }
+
+  static void free_node(rcu::rcu_head* head) {
+    delete reinterpret_cast<node*>(head);
+  }
+
+  static void free_chain(node* n) {
+    while (n) {
+      node* next = n->next;
+      delete n;
+      n = next;
+    }
+  }
+
+  Lock& stripe_of(size_t hash) {
+    return _stripes[hash & (_num_stripes - 1)].lock;
+  }
+
+  // 找到hash当前所在的桶，需要在读端临界区内调用
+  bucket* locate(size_t hash) {
+    table* t = rcu::rcu_dereference(_table);
+    bucket* b = &t->buckets[hash & t->mask];
+    while (b->migrated.load(std::memory_order_acquire)) {
+      t = t->next.load(std::memory_order_acquire);
+      b = &t->buckets[hash & t->mask];
+    }
+    return b;
+  }
+
+  node* lookup(bucket* b, size_t hash, const Key& key) {
+    for (node* n = rcu::rcu_dereference(b->head); n;
+         n = rcu::rcu_dereference(n->next)) {
+      if (n->hash == hash && _equal(n->key, key))
+        return n;
+    }
+    return nullptr;
+  }
+
+  // 返回指向目标节点的指针所在的位置，不存在时指向链表末尾的nullptr，需要持有锁
+  node** find_prev(bucket* b, size_t hash, const Key& key) {
+    node** prev = &b->head;
+    while (*prev && !((*prev)->hash == hash && _equal((*prev)->key, key)))
+      prev = &(*prev)->next;
+    return prev;
+  }
+
+  // 需要在读端临界区内调用
+  void maybe_grow(size_t size) {
+    table* t = rcu::rcu_dereference(_table);
+    if (size <= (t->mask + 1) * _max_load ||
+        t->next.load(std::memory_order_relaxed) != nullptr)
+      return;
+    table* nt = alloc_table((t->mask + 1) * 2);
+    table* expected = nullptr;
+    if (!t->next.compare_exchange_strong(expected, nt,
+                                         std::memory_order_release,
+                                         std::memory_order_relaxed))
+      free_table(nt);
+  }
+
+  // 旧表的第i个桶拆分到新表的i和i+n两个桶，需要持有该桶的锁
+  void migrate_bucket(table* t, table* nt, size_t i) {
+    bucket* b = &t->buckets[i];
+    node* heads[2] = {nullptr, nullptr};
+    for (node* n = b->head; n; n = n->next) {
+      size_t idx = (n->hash & nt->mask) == i ? 0 : 1;
+      heads[idx] = new node{{}, heads[idx], n->hash, n->key, n->value};
+    }
+    rcu::rcu_assign_pointer(nt->buckets[i].head, heads[0]);
+    rcu::rcu_assign_pointer(nt->buckets[i + t->mask + 1].head, heads[1]);
+    b->migrated.store(true, std::memory_order_release);
+    // 还在旧链表上的读者需要等宽限期结束
+    node* n = b->head;
+    while (n) {
+      node* next = n->next;
+      rcu::call_rcu(&n->rcu, free_node);
+      n = next;
+    }
+  }
+
+  // 增量迁移最多migrate_batch个桶
+  task<void> migrate() {
+    for (int k = 0; k < migrate_batch; ++k) {
+      rcu::rcu_read_lock();
+      table* t = rcu::rcu_dereference(_table);
+      table* nt = t->next.load(std::memory_order_acquire);
+      size_t i = nt ? t->cursor.fetch_add(1, std::memory_order_relaxed) : 0;
+      rcu::rcu_read_unlock();
+      if (nt == nullptr || i > t->mask)
+        co_return;
+      // 第i个桶迁移完之前旧表不会被回收，所以这里挂起之后t仍然有效
+      Lock& lock = stripe_of(i);
+      co_await lock.coLock();
+      rcu::rcu_read_lock();
+      migrate_bucket(t, nt, i);
+      if (t->migrated.fetch_add(1, std::memory_order_acq_rel) == t->mask) {
+        rcu::rcu_assign_pointer(_table, nt);
+        rcu::call_rcu(&t->rcu, free_table_rcu);
+      }
+      rcu::rcu_read_unlock();
+      lock.unlock();
+    }
+  }
+
+  table* _table;
+  stripe* _stripes;
+  size_t _num_stripes;
+  size_t _max_load;
+  std::atomic<size_t> _size;
+  [[no_unique_address]] Hash _hasher;
+  [[no_unique_address]] KeyEqual _equal;
+};
+
+}  // namespace cds
+}  // namespace pmss
+
+#endif  // RCU_HASHMAP_H
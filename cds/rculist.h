@@ -11,13 +11,11 @@
 
 #ifndef _RCULIST_H
 #define _RCULIST_H
+#include "list.h"
 #include "rcu.hpp"
 using namespace pmss::rcu;
 
-struct ListNode {
-  ListNode* next;
-  ListNode* prev;
-};
+#define CMM_STORE_SHARED(x, v) rcu_assign_pointer(x, v)
 
 /* Add new element at the head of the list. */
 static inline void cds_list_add_rcu(struct ListNode* newp,
@@ -0,0 +1,234 @@
+#ifndef RCU_RADIX_H
+#define RCU_RADIX_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include "mutex.hpp"
+#include "rcu.hpp"
+#include "task.hpp"
+
+namespace pmss {
+namespace cds {
+
+// RCU保护的基数树，把64位下标（比如LBA）映射到T*（比如缓存页）
+//
+// 每个节点64个槽，每层用下标的6位，树高随最大下标增长，查找是O(树高)。
+// 连续的下标落在同一个叶子节点的相邻槽里，顺序访问局部性好，也不需要保存key。
+//
+// 读者：lookup/gang_lookup只沿槽指针往下走，需要在rcu读端临界区内调用，
+//      返回的指针在临界区结束之前有效，条目本身的回收由调用者负责
+// 写者：整棵树一把协程锁，拿到锁之后不会挂起；
+//      新节点初始化完成之后才会发布，变空的节点摘除之后通过call_rcu回收
+template <typename T>
+class RcuRadixTree {
+ public:
+  static constexpr int map_shift = 6;
+  static constexpr int map_size = 1 << map_shift;
+  static constexpr uint64_t map_mask = map_size - 1;
+  // 根节点最大的shift，11层覆盖全部64位
+  static constexpr int max_shift = 60;
+
+ private:
+  struct alignas(64) node {
+    // 必须是第一个成员
+    rcu::rcu_head rcu;
+    uint8_t shift;
+    uint8_t count;
+    // shift为0时槽里是T*，否则是下一层的node*
+    void* slots[map_size];
+  };
+
+ public:
+  RcuRadixTree() : _root(nullptr), _size(0) {}
+
+  RcuRadixTree(const RcuRadixTree&) = delete;
+  RcuRadixTree& operator=(const RcuRadixTree&) = delete;
+
+  // 只释放节点，不释放条目。调用者需要保证此时没有并发的读者和写者
+  ~RcuRadixTree() {
+    if (_root)
+      free_tree(_root);
+  }
+
+  // 需要在读端临界区内调用
+  T* lookup(uint64_t index) {
+    node* n = rcu::rcu_dereference(_root);
+    if (n == nullptr || index > max_index(n->shift))
+      return nullptr;
+    while (true) {
+      void* slot =
+          rcu::rcu_dereference(n->slots[(index >> n->shift) & map_mask]);
+      if (slot == nullptr || n->shift == 0)
+        return static_cast<T*>(slot);
+      n = static_cast<node*>(slot);
+    }
+  }
+
+  // 按下标从小到大收集从first开始的最多max个条目，indices可以为nullptr，
+  // 返回找到的个数。需要在读端临界区内调用
+  unsigned gang_lookup(uint64_t first, unsigned max, T** results,
+                       uint64_t* indices = nullptr) {
+    node* n = rcu::rcu_dereference(_root);
+    unsigned count = 0;
+    if (n == nullptr || max == 0 || first > max_index(n->shift))
+      return 0;
+    gang(n, 0, first, max, results, indices, count);
+    return count;
+  }
+
+  // index已经存在时返回false
+  task<bool> insert(uint64_t index, T* item) {
+    co_await _lock.coLock();
+    if (_root == nullptr)
+      rcu::rcu_assign_pointer(_root, alloc_node(shift_for(index)));
+    while (index > max_index(_root->shift))
+      extend();
+
+    node* n = _root;
+    while (n->shift > 0) {
+      void*& slot = n->slots[(index >> n->shift) & map_mask];
+      if (slot == nullptr) {
+        rcu::rcu_assign_pointer(slot,
+                                (void*)alloc_node(n->shift - map_shift));
+        ++n->count;
+      }
+      n = static_cast<node*>(slot);
+    }
+    void*& slot = n->slots[index & map_mask];
+    bool inserted = slot == nullptr;
+    if (inserted) {
+      rcu::rcu_assign_pointer(slot, (void*)item);
+      ++n->count;
+      _size.fetch_add(1, std::memory_order_relaxed);
+    }
+    _lock.unlock();
+    co_return inserted;
+  }
+
+  // 返回被删除的条目，不存在时返回nullptr。
+  // 读者可能还拿着这个条目，调用者需要等宽限期之后再回收它
+  task<T*> erase(uint64_t index) {
+    co_await _lock.coLock();
+    node* path[max_shift / map_shift + 1];
+    int depth = 0;
+    node* n = _root;
+    T* item = nullptr;
+    if (n && index <= max_index(n->shift)) {
+      while (true) {
+        path[depth++] = n;
+        void* slot = n->slots[(index >> n->shift) & map_mask];
+        if (slot == nullptr || n->shift == 0) {
+          item = static_cast<T*>(slot);
+          break;
+        }
+        n = static_cast<node*>(slot);
+      }
+    }
+    if (item) {
+      // 自底向上清空槽，变空的节点从父节点摘除
+      while (depth > 0) {
+        n = path[--depth];
+        rcu::rcu_assign_pointer(n->slots[(index >> n->shift) & map_mask],
+                                (void*)nullptr);
+        if (--n->count > 0)
+          break;
+        if (depth == 0)
+          rcu::rcu_assign_pointer(_root, (node*)nullptr);
+        rcu::call_rcu(&n->rcu, free_node);
+      }
+      shrink();
+      _size.fetch_sub(1, std::memory_order_relaxed);
+    }
+    _lock.unlock();
+    co_return item;
+  }
+
+  size_t size() const { return _size.load(std::memory_order_relaxed); }
+
+ private:
+  static uint64_t max_index(int shift) {
+    return shift + map_shift >= 64 ? ~0ull : (1ull << (shift + map_shift)) - 1;
+  }
+
+  static int shift_for(uint64_t index) {
+    int shift = 0;
+    while (index > max_index(shift))
+      shift += map_shift;
+    return shift;
+  }
+
+  static node* alloc_node(int shift) {
+    node* n = new node;
+    n->shift = shift;
+    n->count = 0;
+    for (int i = 0; i < map_size; ++i)
+      n->slots[i] = nullptr;
+    return n;
+  }
+
+  static void free_node(rcu::rcu_head* head) {
+    delete reinterpret_cast<node*>(head);
+  }
+
+  static void free_tree(node* n) {
+    if (n->shift > 0) {
+      for (int i = 0; i < map_size; ++i) {
+        if (n->slots[i])
+          free_tree(static_cast<node*>(n->slots[i]));
+      }
+    }
+    delete n;
+  }
+
+  // 在根节点上面加一层，旧的根成为新根的第0个槽，持有锁时调用
+  void extend() {
+    node* n = alloc_node(_root->shift + map_shift);
+    n->slots[0] = _root;
+    n->count = 1;
+    rcu::rcu_assign_pointer(_root, n);
+  }
+
+  // 根节点只剩第0个槽时降低树高，持有锁时调用。
+  // 还在旧根上的读者会继续走到同一个子节点，所以旧根等宽限期之后再回收
+  void shrink() {
+    while (_root && _root->shift > 0 && _root->count == 1 &&
+           _root->slots[0] != nullptr) {
+      node* old = _root;
+      rcu::rcu_assign_pointer(_root, static_cast<node*>(old->slots[0]));
+      rcu::call_rcu(&old->rcu, free_node);
+    }
+  }
+
+  // 返回true表示已经收集满
+  bool gang(node* n, uint64_t base, uint64_t first, unsigned max, T** results,
+            uint64_t* indices, unsigned& count) {
+    unsigned start = first > base ? ((first - base) >> n->shift) : 0;
+    for (unsigned off = start; off < map_size; ++off) {
+      void* slot = rcu::rcu_dereference(n->slots[off]);
+      if (slot == nullptr)
+        continue;
+      uint64_t index = base + ((uint64_t)off << n->shift);
+      if (n->shift == 0) {
+        results[count] = static_cast<T*>(slot);
+        if (indices)
+          indices[count] = index;
+        if (++count == max)
+          return true;
+      } else if (gang(static_cast<node*>(slot), index, first, max, results,
+                      indices, count)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  node* _root;
+  std::atomic<size_t> _size;
+  async_simple::coro::Mutex _lock;
+};
+
+}  // namespace cds
+}  // namespace pmss
+
+#endif  // RCU_RADIX_H
@@ -0,0 +1,421 @@
+#ifndef RCU_SKIPLIST_H
+#define RCU_SKIPLIST_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <new>
+#include <utility>
+#include "mutex.hpp"
+#include "rcu.hpp"
+#include "schedule.hpp"
+#include "task.hpp"
+
+namespace pmss {
+namespace cds {
+
+// RCU保护的有序跳表，用于extent/LBA这类需要范围查询的索引
+//
+// 基于lazy skiplist（Herlihy et al.）：
+// 读者：只在rcu读端临界区内沿next指针前进，不加锁，永远不会阻塞
+// 写者：每个节点一把协程Mutex，插入/删除时按key从大到小锁住前驱节点再校验，
+//      持锁期间可以co_await（比如update里做I/O）
+//
+// 写者在挂起之前会给要用到的节点加引用计数，节点从链表摘除之后先等宽限期，
+// 再等所有写者释放引用才会真正回收，所以挂起之后拿到的指针仍然有效。
+// value单独分配，update时整体替换，旧value通过call_rcu回收。
+template <typename Key, typename Value, typename Compare = std::less<Key>>
+class RcuSkipList {
+ public:
+  static constexpr int max_level = 16;
+
+ private:
+  struct value_box {
+    rcu::rcu_head rcu;
+    Value value;
+  };
+
+  struct node {
+    // 必须是第一个成员
+    rcu::rcu_head rcu;
+    // 链表本身持有一个引用，宽限期结束之后释放
+    std::atomic<int> refs;
+    int level;
+    std::atomic<bool> marked;
+    std::atomic<bool> fully_linked;
+    async_simple::coro::Mutex lock;
+    value_box* box;
+    alignas(Key) unsigned char key_storage[sizeof(Key)];
+    node* next[];
+
+    node(int lvl) : refs(1), level(lvl), marked(false), fully_linked(false) {}
+    const Key& key() const {
+      return *std::launder(reinterpret_cast<const Key*>(key_storage));
+    }
+  };
+
+ public:
+  // 读端迭代器，只能在rcu_read_lock和rcu_read_unlock之间使用，期间不能挂起
+  class iterator {
+   public:
+    iterator() : _n(nullptr) {}
+    explicit iterator(node* n) : _n(n) { skip(); }
+
+    const Key& key() const { return _n->key(); }
+    const Value& value() const { return rcu::rcu_dereference(_n->box)->value; }
+
+    iterator& operator++() {
+      _n = rcu::rcu_dereference(_n->next[0]);
+      skip();
+      return *this;
+    }
+    bool operator==(const iterator& other) const { return _n == other._n; }
+    bool operator!=(const iterator& other) const { return _n != other._n; }
+
+   private:
+    // 跳过已经删除或者还没有插入完成的节点
+    void skip() {
+      while (_n && (_n->marked.load(std::memory_order_acquire) ||
+                    !_n->fully_linked.load(std::memory_order_acquire)))
+        _n = rcu::rcu_dereference(_n->next[0]);
+    }
+    node* _n;
+  };
+
+  RcuSkipList() : _head(alloc_node(max_level)), _size(0) {
+    _head->fully_linked.store(true, std::memory_order_relaxed);
+  }
+
+  RcuSkipList(const RcuSkipList&) = delete;
+  RcuSkipList& operator=(const RcuSkipList&) = delete;
+
+  // 调用者需要保证此时没有并发的读者和写者
+  ~RcuSkipList() {
+    node* n = _head->next[0];
+    while (n) {
+      node* next = n->next[0];
+      destroy_node(n);
+      n = next;
+    }
+    _head->~node();
+    ::operator delete(_head);
+  }
+
+  bool find(const Key& key, Value& out) {
+    rcu::rcu_read_lock();
+    node* n = search(key);
+    bool found = n != nullptr;
+    if (found)
+      out = rcu::rcu_dereference(n->box)->value;
+    rcu::rcu_read_unlock();
+    return found;
+  }
+
+  bool contains(const Key& key) {
+    rcu::rcu_read_lock();
+    bool found = search(key) != nullptr;
+    rcu::rcu_read_unlock();
+    return found;
+  }
+
+  // 以下三个需要在读端临界区内调用
+  iterator begin() { return iterator(rcu::rcu_dereference(_head->next[0])); }
+  iterator end() { return iterator(); }
+  // 第一个不小于key的元素
+  iterator lower_bound(const Key& key) {
+    node* pred = _head;
+    node* curr = nullptr;
+    for (int l = max_level - 1; l >= 0; --l) {
+      curr = rcu::rcu_dereference(pred->next[l]);
+      while (curr && _less(curr->key(), key)) {
+        pred = curr;
+        curr = rcu::rcu_dereference(pred->next[l]);
+      }
+    }
+    return iterator(curr);
+  }
+
+  // 对[lo, hi)内的每个元素调用f(key, value)，返回访问的元素个数，f不能挂起
+  template <typename F>
+  size_t range(const Key& lo, const Key& hi, F&& f) {
+    size_t n = 0;
+    rcu::rcu_read_lock();
+    for (iterator it = lower_bound(lo); it != end() && _less(it.key(), hi);
+         ++it, ++n)
+      f(it.key(), it.value());
+    rcu::rcu_read_unlock();
+    return n;
+  }
+
+  // key已经存在时返回false
+  task<bool> insert(const Key& key, const Value& value) {
+    node* preds[max_level];
+    node* succs[max_level];
+    int top = random_level();
+    while (true) {
+      rcu::rcu_read_lock();
+      int found = find(key, preds, succs);
+      if (found != -1) {
+        node* n = succs[found];
+        if (!n->marked.load(std::memory_order_acquire)) {
+          bool linked = n->fully_linked.load(std::memory_order_acquire);
+          rcu::rcu_read_unlock();
+          if (linked)
+            co_return false;
+        } else {
+          rcu::rcu_read_unlock();
+        }
+        // 有写者正在插入或者删除同一个key，稍后重试
+        co_await yield();
+        continue;
+      }
+      hold(preds, succs, top);
+      rcu::rcu_read_unlock();
+
+      int locked = co_await lock_preds(preds, succs, top);
+      bool valid = locked == top;
+      if (valid) {
+        node* n = alloc_node(top);
+        new (n->key_storage) Key(key);
+        n->box = new value_box{{}, value};
+        for (int l = 0; l < top; ++l)
+          n->next[l] = succs[l];
+        for (int l = 0; l < top; ++l)
+          rcu::rcu_assign_pointer(preds[l]->next[l], n);
+        n->fully_linked.store(true, std::memory_order_release);
+        _size.fetch_add(1, std::memory_order_relaxed);
+      }
+      unlock_preds(preds, locked);
+      release(preds, succs, top);
+      if (valid)
+        co_return true;
+    }
+  }
+
+  task<bool> erase(const Key& key) {
+    node* preds[max_level];
+    node* succs[max_level];
+    rcu::rcu_read_lock();
+    int found = find(key, preds, succs);
+    node* victim = found == -1 ? nullptr : succs[found];
+    if (victim == nullptr || !can_delete(victim, found)) {
+      rcu::rcu_read_unlock();
+      co_return false;
+    }
+    ref(victim);
+    rcu::rcu_read_unlock();
+
+    co_await victim->lock.coLock();
+    if (victim->marked.load(std::memory_order_relaxed)) {
+      // 被别的写者抢先删除了
+      victim->lock.unlock();
+      unref(victim);
+      co_return false;
+    }
+    victim->marked.store(true, std::memory_order_release);
+    int top = victim->level;
+    while (true) {
+      rcu::rcu_read_lock();
+      find(key, preds, succs);
+      hold(preds, nullptr, top);
+      rcu::rcu_read_unlock();
+      int locked = co_await lock_preds(preds, nullptr, top, victim);
+      bool valid = locked == top;
+      if (valid) {
+        for (int l = top - 1; l >= 0; --l)
+          rcu::rcu_assign_pointer(preds[l]->next[l], victim->next[l]);
+        _size.fetch_sub(1, std::memory_order_relaxed);
+      }
+      unlock_preds(preds, locked);
+      release(preds, nullptr, top);
+      if (valid)
+        break;
+    }
+    victim->lock.unlock();
+    rcu::call_rcu(&victim->rcu, retire_node);
+    unref(victim);
+    co_return true;
+  }
+
+  // 持有key对应节点的锁调用co_await fn(old_value)，用返回值替换旧value。
+  // fn可以挂起，期间读者看到的仍然是旧value。key不存在时返回false
+  template <typename Fn>
+  task<bool> update(const Key& key, Fn fn) {
+    rcu::rcu_read_lock();
+    node* n = search(key);
+    if (n == nullptr) {
+      rcu::rcu_read_unlock();
+      co_return false;
+    }
+    ref(n);
+    rcu::rcu_read_unlock();
+
+    co_await n->lock.coLock();
+    bool alive = !n->marked.load(std::memory_order_relaxed);
+    if (alive) {
+      value_box* old = n->box;
+      Value v = co_await fn(static_cast<const Value&>(old->value));
+      rcu::rcu_assign_pointer(n->box, new value_box{{}, std::move(v)});
+      rcu::call_rcu(&old->rcu, free_box);
+    }
+    n->lock.unlock();
+    unref(n);
+    co_return alive;
+  }
+
+  size_t size() const { return _size.load(std::memory_order_relaxed); }
+
+ private:
+  static node* alloc_node(int level) {
+    void* mem = ::operator new(sizeof(node) + sizeof(node*) * level);
+    node* n = new (mem) node(level);
+    n->box = nullptr;
+    for (int l = 0; l < level; ++l)
+      n->next[l] = nullptr;
+    return n;
+  }
+
+  static void destroy_node(node* n) {
+    std::launder(reinterpret_cast<Key*>(n->key_storage))->~Key();
+    delete n->box;
+    n->~node();
+    ::operator delete(n);
+  }
+
+  static void free_box(rcu::rcu_head* head) {
+    delete reinterpret_cast<value_box*>(head);
+  }
+
+  static void ref(node* n) { n->refs.fetch_add(1, std::memory_order_relaxed); }
+
+  static void unref(node* n) {
+    if (n->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+      destroy_node(n);
+  }
+
+  // 宽限期结束之后释放链表持有的引用
+  static void retire_node(rcu::rcu_head* head) {
+    unref(reinterpret_cast<node*>(head));
+  }
+
+  static int random_level() {
+    static thread_local uint64_t seed =
+        0x9e3779b97f4a7c15ull ^ (uint64_t)(uintptr_t)&seed;
+    seed ^= seed << 13;
+    seed ^= seed >> 7;
+    seed ^= seed << 17;
+    // 每层概率1/4
+    int level = 1;
+    uint64_t r = seed;
+    while (level < max_level && (r & 3) == 0) {
+      ++level;
+      r >>= 2;
+    }
+    return level;
+  }
+
+  // 需要在读端临界区内调用，返回key所在的最高层，不存在时返回-1
+  int find(const Key& key, node** preds, node** succs) {
+    int found = -1;
+    node* pred = _head;
+    for (int l = max_level - 1; l >= 0; --l) {
+      node* curr = rcu::rcu_dereference(pred->next[l]);
+      while (curr && _less(curr->key(), key)) {
+        pred = curr;
+        curr = rcu::rcu_dereference(pred->next[l]);
+      }
+      if (found == -1 && curr && !_less(key, curr->key()))
+        found = l;
+      preds[l] = pred;
+      succs[l] = curr;
+    }
+    return found;
+  }
+
+  // 需要在读端临界区内调用
+  node* search(const Key& key) {
+    node* pred = _head;
+    for (int l = max_level - 1; l >= 0; --l) {
+      node* curr = rcu::rcu_dereference(pred->next[l]);
+      while (curr && _less(curr->key(), key)) {
+        pred = curr;
+        curr = rcu::rcu_dereference(pred->next[l]);
+      }
+      if (curr && !_less(key, curr->key())) {
+        if (curr->fully_linked.load(std::memory_order_acquire) &&
+            !curr->marked.load(std::memory_order_acquire))
+          return curr;
+        return nullptr;
+      }
+    }
+    return nullptr;
+  }
+
+  bool can_delete(node* n, int found) {
+    return n->fully_linked.load(std::memory_order_acquire) &&
+           n->level - 1 == found && !n->marked.load(std::memory_order_acquire);
+  }
+
+  // 挂起之前给前驱和后继加引用，需要在读端临界区内调用
+  void hold(node** preds, node** succs, int top) {
+    for (int l = 0; l < top; ++l) {
+      if (preds[l] != _head && (l == 0 || preds[l] != preds[l - 1]))
+        ref(preds[l]);
+      if (succs && succs[l] && (l == 0 || succs[l] != succs[l - 1]))
+        ref(succs[l]);
+    }
+  }
+
+  void release(node** preds, node** succs, int top) {
+    for (int l = 0; l < top; ++l) {
+      if (preds[l] != _head && (l == 0 || preds[l] != preds[l - 1]))
+        unref(preds[l]);
+      if (succs && succs[l] && (l == 0 || succs[l] != succs[l - 1]))
+        unref(succs[l]);
+    }
+  }
+
+  // 从第0层开始（key从大到小）依次锁住前驱并校验，返回校验通过的层数。
+  // 插入时校验后继没有被删除，删除时校验前驱仍然指向victim
+  task<int> lock_preds(node** preds, node** succs, int top,
+                       node* victim = nullptr) {
+    int l = 0;
+    for (; l < top; ++l) {
+      node* pred = preds[l];
+      if (l == 0 || pred != preds[l - 1])
+        co_await pred->lock.coLock();
+      node* succ = succs ? succs[l] : victim;
+      bool valid = !pred->marked.load(std::memory_order_acquire) &&
+                   pred->next[l] == succ;
+      if (succs && succ)
+        valid = valid && !succ->marked.load(std::memory_order_acquire);
+      if (!valid) {
+        // 校验失败的这一层的锁在这里释放（和下一层共用前驱时不用释放），
+        // 返回l，调用者的unlock_preds只释放0..l-1层
+        if (l == 0 || pred != preds[l - 1])
+          pred->lock.unlock();
+        break;
+      }
+    }
+    co_return l;
+  }
+
+  void unlock_preds(node** preds, int locked) {
+    for (int l = 0; l < locked; ++l) {
+      if (l == 0 || preds[l] != preds[l - 1])
+        preds[l]->lock.unlock();
+    }
+  }
+
+  node* _head;
+  std::atomic<size_t> _size;
+  [[no_unique_address]] Compare _cmp;
+
+  bool _less(const Key& a, const Key& b) const { return _cmp(a, b); }
+};
+
+}  // namespace cds
+}  // namespace pmss
+
+#endif  // RCU_SKIPLIST_H
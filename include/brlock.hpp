@@ -0,0 +1,190 @@
+#ifndef ASYNC_SIMPLE_CORO_BR_LOCK_H
+#define ASYNC_SIMPLE_CORO_BR_LOCK_H
+
+#include <atomic>
+#include <cassert>
+#include <coroutine>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include "mutex.hpp"
+#include "rcu.hpp"
+#include "schedule.hpp"
+#include "task.hpp"
+
+namespace async_simple {
+namespace coro {
+
+// big-reader lock，适合读多写极少的场景
+//
+// 每个spdk_thread一个独占cache line的读者计数（和rcu.cpp里的读者状态一样按
+// spdk_thread的编号索引），读者加锁解锁只改自己的计数，多个核之间不会互相抢
+// cache line。
+// 写者先拿_wlock互斥，再置位_writer，然后co_await yield()直到所有核上的读者
+// 计数都归零。写锁代价是O(核数)，所以只适合写很少的场景。
+//
+// 读者先增加计数再检查_writer，写者先置位_writer再检查计数，两边都是seq_cst，
+// 所以要么读者看到_writer退回去，要么写者看到读者的计数等它退出。
+// 读者要在加锁的spdk_thread上解锁（本库的协程总是在自己的spdk_thread上恢复）。
+//
+// 有写者时读者挂在_waiters上，不占用reactor，写者unlock()时把它们各自发回
+// 自己的spdk_thread重新加锁。
+//
+// 计数数组的大小是spdk_thread的数量：BrLock可能在init_service之前构造（比如
+// 全局变量），所以所有BrLock串在一个链表上，通过on_workers_resized在
+// init_service确定数量之后统一重新分配。两次run之间不能持有BrLock。
+class BrLock {
+ private:
+  struct alignas(64) reader_count {
+    std::atomic<long> count;
+  };
+
+  class SharedLockAwaiter {
+   public:
+    explicit SharedLockAwaiter(BrLock& lock) noexcept : _lock(lock) {}
+
+    bool await_ready() noexcept { return _lock.tryLockShared(); }
+
+    // 有写者时挂到等待链表上，不需要分配协程帧
+    bool await_suspend(std::coroutine_handle<> h) noexcept {
+      _h = h;
+      _thread = spdk_get_thread();
+      pmss::rcu::rcu_offline();
+      return _lock.parkShared(this);
+    }
+
+    void await_resume() noexcept {}
+
+   private:
+    friend class BrLock;
+
+    // 写者unlock()之后在自己的spdk_thread上重试，又有写者了就再挂回去
+    static void retry(void* arg) {
+      auto* self = static_cast<SharedLockAwaiter*>(arg);
+      if (!self->_lock.parkShared(self))
+        pmss::trampoline_resume(self->_h);
+    }
+
+    BrLock& _lock;
+    std::coroutine_handle<> _h;
+    spdk_thread* _thread = nullptr;
+    SharedLockAwaiter* _next = nullptr;
+  };
+
+ public:
+  BrLock() : _writer(false) {
+    pmss::on_workers_resized(resizeAll);
+    std::lock_guard<std::mutex> guard(_allGuard);
+    resize(pmss::num_workers);
+    _next = _all;
+    _all = this;
+  }
+
+  ~BrLock() {
+    assert(_waiters == nullptr);
+    std::lock_guard<std::mutex> guard(_allGuard);
+    BrLock** p = &_all;
+    while (*p != this)
+      p = &(*p)->_next;
+    *p = _next;
+  }
+
+  BrLock(const BrLock&) = delete;
+  BrLock& operator=(const BrLock&) = delete;
+
+  // Shared ownership
+
+  bool tryLockShared() noexcept {
+    std::atomic<long>& count = local();
+    count.fetch_add(1, std::memory_order_seq_cst);
+    if (!_writer.load(std::memory_order_seq_cst)) [[likely]]
+      return true;
+    count.fetch_sub(1, std::memory_order_release);
+    return false;
+  }
+
+  [[nodiscard]] SharedLockAwaiter coLockShared() noexcept {
+    return SharedLockAwaiter(*this);
+  }
+
+  void unlockShared() noexcept {
+    local().fetch_sub(1, std::memory_order_release);
+  }
+
+  // Exclusive ownership
+
+  task<int> coLock() noexcept {
+    co_await _wlock.coLock();
+    _writer.store(true, std::memory_order_seq_cst);
+    for (uint32_t i = 0; i < _size; ++i) {
+      while (_readers[i].count.load(std::memory_order_acquire) != 0)
+        co_await yield();
+    }
+    co_return 0;
+  }
+
+  void unlock() noexcept {
+    _writer.store(false, std::memory_order_release);
+    SharedLockAwaiter* w;
+    {
+      std::lock_guard<std::mutex> guard(_waitGuard);
+      w = std::exchange(_waiters, nullptr);
+    }
+    while (w) {
+      // 发出去之后w随时可能恢复并销毁，先取下一个
+      SharedLockAwaiter* next = w->_next;
+      spdk_thread_send_msg(w->_thread, SharedLockAwaiter::retry, w);
+      w = next;
+    }
+    _wlock.unlock();
+  }
+
+ private:
+  // 拿到读锁返回false，否则把w挂到等待链表上返回true。
+  // 在_waitGuard下检查：unlock()先清_writer再在_waitGuard下取走链表，
+  // 挂上去的读者一定会被这次或者之后的unlock()看到
+  bool parkShared(SharedLockAwaiter* w) noexcept {
+    std::lock_guard<std::mutex> guard(_waitGuard);
+    if (tryLockShared())
+      return false;
+    w->_next = _waiters;
+    _waiters = w;
+    return true;
+  }
+
+  // init_service调用，这时没有spdk_thread在运行
+  static void resizeAll(int workers) {
+    std::lock_guard<std::mutex> guard(_allGuard);
+    for (BrLock* l = _all; l; l = l->_next)
+      l->resize(workers);
+  }
+
+  std::atomic<long>& local() noexcept {
+    int i = pmss::worker_index();
+    assert(i >= 0 && (uint32_t)i < _size);
+    return _readers[i].count;
+  }
+
+  void resize(uint32_t workers) {
+    _readers = std::make_unique<reader_count[]>(workers);
+    _size = workers;
+  }
+
+  std::unique_ptr<reader_count[]> _readers;
+  uint32_t _size = 0;
+  BrLock* _next;
+  alignas(64) std::atomic<bool> _writer;
+  Mutex _wlock;
+  // 等写者解锁的读者，只在_waitGuard下访问
+  std::mutex _waitGuard;
+  SharedLockAwaiter* _waiters = nullptr;
+
+  inline static BrLock* _all = nullptr;
+  inline static std::mutex _allGuard;
+};
+
+}  // namespace coro
+}  // namespace async_simple
+
+#endif  // ASYNC_SIMPLE_CORO_BR_LOCK_H
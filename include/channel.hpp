@@ -0,0 +1,419 @@
+#ifndef ASYNC_SIMPLE_CORO_CHANNEL_H
+#define ASYNC_SIMPLE_CORO_CHANNEL_H
+
+#include <atomic>
+#include <cassert>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <optional>
+#include <utility>
+#include "rcu.hpp"
+#include "schedule.hpp"
+#include "spinlock.hpp"
+
+namespace async_simple {
+namespace coro {
+
+// 有界的多生产者多消费者协程channel，用于跨reactor的流水线
+//
+// 存储是Vyukov的有界MPMC环形队列，没有等待者时send/recv只在环上做一次CAS，
+// 不加锁也不分配内存。
+// 环满时发送者挂起、环空时接收者挂起，awaiter挂在_guard保护的FIFO链表上。
+// 任何一次成功的send/recv之后如果发现有等待者，就在_guard下把环里的元素直接
+// 交给等待的接收者、把等待的发送者的元素放进环里（handoff），
+// 然后在等待者自己的reactor上恢复它，所以被唤醒的协程不需要重试。
+//
+// 等待者入队前先增加_waiters再重试一次，成功操作之后先fence再读_waiters，
+// 所以要么等待者重试成功，要么另一方看到有等待者，不会丢失唤醒。
+template <typename T>
+class Channel {
+ private:
+  struct Waiter {
+    std::coroutine_handle<> _h;
+    spdk_thread* _thread;
+    Waiter* _next;
+  };
+
+  struct RecvWaiter : Waiter {
+    std::optional<T> _item;
+  };
+
+  struct SendWaiter : Waiter {
+    T* _value;
+    bool _ok;
+  };
+
+  struct Cell {
+    std::atomic<size_t> seq;
+    alignas(T) unsigned char storage[sizeof(T)];
+  };
+
+  class SendAwaiter;
+  class RecvAwaiter;
+  class RecvManyAwaiter;
+
+ public:
+  // capacity会向上取整到2的幂
+  explicit Channel(size_t capacity)
+      : _waiters(0),
+        _closed(false),
+        _guard(false),
+        _recvHead(nullptr),
+        _recvTail(nullptr),
+        _sendHead(nullptr),
+        _sendTail(nullptr) {
+    size_t n = 2;
+    while (n < capacity)
+      n <<= 1;
+    _mask = n - 1;
+    _cells = new Cell[n];
+    for (size_t i = 0; i < n; ++i)
+      _cells[i].seq.store(i, std::memory_order_relaxed);
+    _enqueuePos.store(0, std::memory_order_relaxed);
+    _dequeuePos.store(0, std::memory_order_relaxed);
+  }
+
+  Channel(const Channel&) = delete;
+  Channel& operator=(const Channel&) = delete;
+
+  // 调用者需要保证此时没有等待者
+  ~Channel() {
+    assert(_recvHead == nullptr && _sendHead == nullptr);
+    std::optional<T> item;
+    while (tryPop(item))
+      item.reset();
+    delete[] _cells;
+  }
+
+  // 非阻塞版本，环满或者已经关闭时返回false
+  bool trySend(T value) {
+    if (_closed.load(std::memory_order_acquire) || !tryPush(value))
+      return false;
+    afterOp();
+    return true;
+  }
+
+  // 非阻塞版本，环空时返回std::nullopt
+  std::optional<T> tryRecv() {
+    std::optional<T> item;
+    if (tryPop(item))
+      afterOp();
+    return item;
+  }
+
+  // co_await的结果为false表示channel已经关闭，value没有发送出去
+  [[nodiscard]] SendAwaiter send(T value) {
+    return SendAwaiter(*this, std::move(value));
+  }
+
+  // co_await的结果为std::nullopt表示channel已经关闭并且取空了
+  [[nodiscard]] RecvAwaiter recv() { return RecvAwaiter(*this); }
+
+  // 一次最多取max个元素放到out里，至少取到一个才返回，
+  // co_await的结果为0表示channel已经关闭并且取空了
+  [[nodiscard]] RecvManyAwaiter recv_many(T* out, size_t max) {
+    assert(max > 0);
+    return RecvManyAwaiter(*this, out, max);
+  }
+
+  // 关闭之后send都会失败，接收者取完剩下的元素之后得到std::nullopt
+  void close() {
+    _closed.store(true, std::memory_order_seq_cst);
+    lockGuard();
+    pump();
+  }
+
+  bool closed() const { return _closed.load(std::memory_order_acquire); }
+
+  size_t capacity() const { return _mask + 1; }
+
+ private:
+  class SendAwaiter : public SendWaiter {
+   public:
+    SendAwaiter(Channel& ch, T&& value) : _ch(ch), _v(std::move(value)) {
+      this->_value = &_v;
+      this->_ok = false;
+    }
+
+    bool await_ready() {
+      if (_ch._closed.load(std::memory_order_acquire))
+        return true;
+      if (_ch._waiters.load(std::memory_order_relaxed) == 0 && _ch.tryPush(_v)) {
+        this->_ok = true;
+        _ch.afterOp();
+        return true;
+      }
+      return false;
+    }
+
+    bool await_suspend(std::coroutine_handle<> h) {
+      this->_h = h;
+      this->_thread = spdk_get_thread();
+      return _ch.parkSender(this);
+    }
+
+    bool await_resume() { return this->_ok; }
+
+   private:
+    Channel& _ch;
+    T _v;
+  };
+
+  class RecvAwaiter : public RecvWaiter {
+   public:
+    explicit RecvAwaiter(Channel& ch) : _ch(ch) {}
+
+    bool await_ready() {
+      if (_ch.tryPop(this->_item)) {
+        _ch.afterOp();
+        return true;
+      }
+      return false;
+    }
+
+    bool await_suspend(std::coroutine_handle<> h) {
+      this->_h = h;
+      this->_thread = spdk_get_thread();
+      return _ch.parkReceiver(this);
+    }
+
+    std::optional<T> await_resume() { return std::move(this->_item); }
+
+   private:
+    Channel& _ch;
+  };
+
+  class RecvManyAwaiter : public RecvWaiter {
+   public:
+    RecvManyAwaiter(Channel& ch, T* out, size_t max)
+        : _ch(ch), _out(out), _max(max) {}
+
+    bool await_ready() {
+      if (_ch.tryPop(this->_item)) {
+        _ch.afterOp();
+        return true;
+      }
+      return false;
+    }
+
+    bool await_suspend(std::coroutine_handle<> h) {
+      this->_h = h;
+      this->_thread = spdk_get_thread();
+      return _ch.parkReceiver(this);
+    }
+
+    // 已经拿到一个元素，再把环里现有的尽量多取一些，整批只恢复一次
+    size_t await_resume() {
+      if (!this->_item)
+        return 0;
+      size_t n = 0;
+      _out[n++] = std::move(*this->_item);
+      std::optional<T> item;
+      while (n < _max && _ch.tryPop(item)) {
+        _out[n++] = std::move(*item);
+        item.reset();
+      }
+      if (n > 1)
+        _ch.afterOp();
+      return n;
+    }
+
+   private:
+    Channel& _ch;
+    T* _out;
+    size_t _max;
+  };
+
+  bool tryPush(T& value) {
+    size_t pos = _enqueuePos.load(std::memory_order_relaxed);
+    Cell* cell;
+    while (true) {
+      cell = &_cells[pos & _mask];
+      size_t seq = cell->seq.load(std::memory_order_acquire);
+      intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+      if (dif == 0) {
+        if (_enqueuePos.compare_exchange_weak(pos, pos + 1,
+                                              std::memory_order_relaxed))
+          break;
+      } else if (dif < 0) {
+        return false;
+      } else {
+        pos = _enqueuePos.load(std::memory_order_relaxed);
+      }
+    }
+    new (cell->storage) T(std::move(value));
+    cell->seq.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  bool tryPop(std::optional<T>& out) {
+    size_t pos = _dequeuePos.load(std::memory_order_relaxed);
+    Cell* cell;
+    while (true) {
+      cell = &_cells[pos & _mask];
+      size_t seq = cell->seq.load(std::memory_order_acquire);
+      intptr_t dif = (intptr_t)seq - (intptr_t)(pos + 1);
+      if (dif == 0) {
+        if (_dequeuePos.compare_exchange_weak(pos, pos + 1,
+                                              std::memory_order_relaxed))
+          break;
+      } else if (dif < 0) {
+        return false;
+      } else {
+        pos = _dequeuePos.load(std::memory_order_relaxed);
+      }
+    }
+    T* p = std::launder(reinterpret_cast<T*>(cell->storage));
+    out.emplace(std::move(*p));
+    p->~T();
+    cell->seq.store(pos + _mask + 1, std::memory_order_release);
+    return true;
+  }
+
+  // 成功send/recv之后检查有没有需要handoff的等待者
+  void afterOp() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (_waiters.load(std::memory_order_relaxed) > 0) [[unlikely]] {
+      lockGuard();
+      pump();
+    }
+  }
+
+  // 返回true表示需要挂起
+  bool parkSender(SendWaiter* w) {
+    lockGuard();
+    _waiters.fetch_add(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (_closed.load(std::memory_order_relaxed)) {
+      _waiters.fetch_sub(1, std::memory_order_relaxed);
+      unlockGuard();
+      return false;
+    }
+    if (_sendHead == nullptr && tryPush(*w->_value)) {
+      _waiters.fetch_sub(1, std::memory_order_relaxed);
+      w->_ok = true;
+      pump();
+      return false;
+    }
+    w->_next = nullptr;
+    if (_sendTail)
+      _sendTail->_next = w;
+    else
+      _sendHead = w;
+    _sendTail = w;
+    unlockGuard();
+    pmss::rcu::rcu_offline();
+    return true;
+  }
+
+  bool parkReceiver(RecvWaiter* w) {
+    lockGuard();
+    _waiters.fetch_add(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (_recvHead == nullptr && tryPop(w->_item)) {
+      _waiters.fetch_sub(1, std::memory_order_relaxed);
+      pump();
+      return false;
+    }
+    if (_closed.load(std::memory_order_relaxed)) {
+      _waiters.fetch_sub(1, std::memory_order_relaxed);
+      unlockGuard();
+      return false;
+    }
+    w->_next = nullptr;
+    if (_recvTail)
+      _recvTail->_next = w;
+    else
+      _recvHead = w;
+    _recvTail = w;
+    unlockGuard();
+    pmss::rcu::rcu_offline();
+    return true;
+  }
+
+  // 持有_guard时调用，返回前释放_guard，然后在各自的线程上恢复完成的等待者
+  void pump() {
+    Waiter* woken = nullptr;
+    bool progress = true;
+    while (progress) {
+      progress = false;
+      while (_recvHead && tryPop(_recvHead->_item)) {
+        RecvWaiter* w = _recvHead;
+        _recvHead = static_cast<RecvWaiter*>(w->_next);
+        if (_recvHead == nullptr)
+          _recvTail = nullptr;
+        w->_next = woken;
+        woken = w;
+        progress = true;
+      }
+      while (_sendHead && tryPush(*_sendHead->_value)) {
+        SendWaiter* w = _sendHead;
+        w->_ok = true;
+        _sendHead = static_cast<SendWaiter*>(w->_next);
+        if (_sendHead == nullptr)
+          _sendTail = nullptr;
+        w->_next = woken;
+        woken = w;
+        progress = true;
+      }
+    }
+    if (_closed.load(std::memory_order_relaxed)) {
+      // 环已经取空的话剩下的接收者都得到std::nullopt，发送者都失败
+      if (_dequeuePos.load(std::memory_order_relaxed) ==
+          _enqueuePos.load(std::memory_order_relaxed)) {
+        while (_recvHead) {
+          Waiter* w = _recvHead;
+          _recvHead = static_cast<RecvWaiter*>(w->_next);
+          w->_next = woken;
+          woken = w;
+        }
+        _recvTail = nullptr;
+      }
+      while (_sendHead) {
+        Waiter* w = _sendHead;
+        _sendHead = static_cast<SendWaiter*>(w->_next);
+        w->_next = woken;
+        woken = w;
+      }
+      _sendTail = nullptr;
+    }
+    long n = 0;
+    for (Waiter* w = woken; w; w = w->_next)
+      ++n;
+    _waiters.fetch_sub(n, std::memory_order_relaxed);
+    unlockGuard();
+    while (woken) {
+      // resume之后awaiter可能就析构了
+      Waiter* next = woken->_next;
+      pmss::resume_on(woken->_thread, woken->_h);
+      woken = next;
+    }
+  }
+
+  void lockGuard() {
+    while (_guard.exchange(true, std::memory_order_acquire))
+      cpuRelax();
+  }
+
+  void unlockGuard() { _guard.store(false, std::memory_order_release); }
+
+  alignas(64) std::atomic<size_t> _enqueuePos;
+  alignas(64) std::atomic<size_t> _dequeuePos;
+  alignas(64) std::atomic<long> _waiters;
+  std::atomic<bool> _closed;
+  std::atomic<bool> _guard;
+  // 以下成员由_guard保护
+  RecvWaiter* _recvHead;
+  RecvWaiter* _recvTail;
+  SendWaiter* _sendHead;
+  SendWaiter* _sendTail;
+  Cell* _cells;
+  size_t _mask;
+};
+
+}  // namespace coro
+}  // namespace async_simple
+
+#endif  // ASYNC_SIMPLE_CORO_CHANNEL_H
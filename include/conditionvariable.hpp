@@ -21,6 +21,8 @@
 #include <atomic>
 #include <cassert>
 #include <mutex>
+#include <type_traits>
+#include <utility>
 
 namespace async_simple {
 namespace coro {
@@ -28,6 +30,9 @@ namespace coro {
 template <class Lock>
 class ConditionVariableAwaiter;
 
+template <class Lock, class Pred>
+class ConditionVariableWaitAwaiter;
+
 template <class Lock>
 class ConditionVariable {
  public:
@@ -41,14 +46,21 @@ class ConditionVariable {
   void notifyOne() noexcept;
   void notifyAll() noexcept;
 
+  // pred已经满足时不会挂起，也不会分配协程帧
   template <class Pred>
-  task<int> wait(Lock& lock, Pred&& pred) noexcept;
+  [[nodiscard]] ConditionVariableWaitAwaiter<Lock, std::decay_t<Pred>> wait(
+      Lock& lock, Pred&& pred) noexcept;
 
  private:
   void resumeWaiters(ConditionVariableAwaiter<Lock>* awaiters);
 
+  template <class Pred>
+  task<int> waitSlow(Lock& lock, Pred& pred) noexcept;
+
  private:
   friend class ConditionVariableAwaiter<Lock>;
+  template <class, class>
+  friend class ConditionVariableWaitAwaiter;
   std::atomic<ConditionVariableAwaiter<Lock>*> _awaiters = nullptr;
 };
 
@@ -82,10 +94,39 @@ class ConditionVariableAwaiter {
   std::coroutine_handle<> _continuation;
 };
 
+template <class Lock, class Pred>
+class ConditionVariableWaitAwaiter : public slow_path_awaiter {
+ public:
+  ConditionVariableWaitAwaiter(ConditionVariable<Lock>* cv, Lock& lock,
+                               Pred pred) noexcept
+      : _cv(cv), _lock(lock), _pred(std::move(pred)) {}
+
+  bool await_ready() noexcept {
+    if (_pred())
+      return true;
+    // 挂起期间这个awaiter一直存活，慢速路径直接引用_pred
+    _slow.emplace(_cv->waitSlow(_lock, _pred));
+    return false;
+  }
+
+ private:
+  ConditionVariable<Lock>* _cv;
+  Lock& _lock;
+  Pred _pred;
+};
+
+template <class Lock>
+template <class Pred>
+inline ConditionVariableWaitAwaiter<Lock, std::decay_t<Pred>>
+ConditionVariable<Lock>::wait(Lock& lock, Pred&& pred) noexcept {
+  return ConditionVariableWaitAwaiter<Lock, std::decay_t<Pred>>(
+      this, lock, std::forward<Pred>(pred));
+}
+
 template <class Lock>
 template <class Pred>
-inline task<int> ConditionVariable<Lock>::wait(Lock& lock,
-                                               Pred&& pred) noexcept {
+inline task<int> ConditionVariable<Lock>::waitSlow(Lock& lock,
+                                                   Pred& pred) noexcept {
   while (!pred()) {
     co_await ConditionVariableAwaiter<Lock>{this, lock};
     co_await lock.coLock();
@@ -122,7 +163,7 @@ inline void ConditionVariable<Lock>::resumeWaiters(
   while (awaiters) {
     auto* prev = awaiters;
     awaiters = awaiters->_next;
-    prev->_continuation.resume();
+    pmss::trampoline_resume(prev->_continuation);
   }
 }
 
@@ -211,7 +252,7 @@ inline void ConditionVariable<void>::resumeWaiters(
   while (awaiters) {
     auto* prev = awaiters;
     awaiters = awaiters->_next;
-    prev->_continuation.resume();
+    pmss::trampoline_resume(prev->_continuation);
   }
 }
 
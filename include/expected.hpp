@@ -0,0 +1,62 @@
+#pragma once
+#ifndef _EXPECTED_H
+#define _EXPECTED_H
+
+#include <cassert>
+#include <utility>
+#include <variant>
+#include "task.hpp"
+
+namespace pmss {
+
+// 热路径上不用异常报告错误：expected<T, E>要么是值要么是错误码，
+// 在-fno-exceptions下也能用，错误码的约定和read/write一样
+template <class E>
+struct unexpected {
+  explicit unexpected(E e) : _error(std::move(e)) {}
+  E _error;
+};
+
+template <class T, class E = int>
+class expected {
+ public:
+  expected(T value) : _v(std::in_place_index<0>, std::move(value)) {}
+  expected(unexpected<E> e) : _v(std::in_place_index<1>, std::move(e._error)) {}
+
+  bool has_value() const { return _v.index() == 0; }
+  explicit operator bool() const { return has_value(); }
+
+  T& value() {
+    assert(has_value());
+    return *std::get_if<0>(&_v);
+  }
+  const T& value() const {
+    assert(has_value());
+    return *std::get_if<0>(&_v);
+  }
+  T& operator*() { return value(); }
+  const T& operator*() const { return value(); }
+  T* operator->() { return &value(); }
+  const T* operator->() const { return &value(); }
+
+  E error() const {
+    assert(!has_value());
+    return *std::get_if<1>(&_v);
+  }
+
+  T value_or(T other) const { return has_value() ? value() : std::move(other); }
+
+ private:
+  std::variant<T, E> _v;
+};
+
+// 返回值或者错误码的task，用法：
+//   expected_task<int> f() { co_return pmss::unexpected(-EIO); }
+//   auto r = co_await f();
+//   if (!r) return r.error();
+template <class T>
+using expected_task = task<expected<T, int>>;
+
+};  // namespace pmss
+
+#endif  // _EXPECTED_H
@@ -0,0 +1,107 @@
+#pragma once
+#ifndef _GENERATOR_H
+#define _GENERATOR_H
+
+#include <cassert>
+#include <coroutine>
+#include <cstdlib>
+#include <exception>
+#include <optional>
+#include <utility>
+#include "task.hpp"
+
+// 异步生成器
+//
+// 和task一样是lazy的，但是可以co_yield多个值，生成器内部也可以co_await
+// 消费者用co_await gen.next()取下一个值，生成器结束之后得到std::nullopt：
+//   while (auto v = co_await gen.next()) { ... }
+// next()把消费者的handle记在promise里，然后转移到生成器运行；
+// 生成器co_yield或者结束的时候再转移回消费者。
+// 生成器内部co_await挂起的时候控制权回到最外层，等唤醒它的回调恢复生成器，
+// 它运行到下一个co_yield时再恢复消费者，所以消费者看到的总是同步的next()。
+template <class T>
+struct async_generator {
+  struct promise_type {
+    std::suspend_always initial_suspend() { return {}; }
+    [[nodiscard]] async_generator<T> get_return_object() {
+      return async_generator<T>(this);
+    }
+
+    // co_yield之后转移回消费者
+    struct yield_awaiter {
+      bool await_ready() const noexcept { return false; }
+      auto await_suspend(std::coroutine_handle<promise_type> gen) noexcept {
+        return gen.promise()._consumer;
+      }
+      void await_resume() noexcept {}
+    };
+
+    template <typename U>
+    yield_awaiter yield_value(U&& value) {
+      _value.emplace(std::forward<U>(value));
+      return yield_awaiter{};
+    }
+
+    void return_void() {}
+
+#if __cpp_exceptions
+    // 和task一样，异常在消费者的next()里重新抛出
+    void unhandled_exception() { _exception = std::current_exception(); }
+    std::exception_ptr _exception = nullptr;
+#else
+    [[noreturn]] static void unhandled_exception() { std::abort(); }
+#endif
+    yield_awaiter final_suspend() noexcept { return yield_awaiter{}; }
+
+    std::coroutine_handle<> _consumer = std::noop_coroutine();
+    // 没有设置时继承第一次调用next()的消费者的优先级
+    uint8_t _priority = pmss::priority_unset;
+    // 最近一次co_yield的值，消费者取走之后清空
+    std::optional<T> _value = std::nullopt;
+  };
+
+  using handle = std::coroutine_handle<promise_type>;
+  handle _h;
+
+  explicit async_generator(promise_type* p) : _h(handle::from_promise(*p)) {}
+  async_generator(async_generator&) = delete;
+  async_generator(async_generator&& g) : _h(g._h) { g._h = nullptr; }
+  // 生成器可以在没有取完的时候析构，这时它一定挂起在co_yield上
+  ~async_generator() {
+    if (_h) {
+      _h.destroy();
+    }
+  }
+
+  struct next_awaiter {
+    bool await_ready() const noexcept { return _h.done(); }
+
+    template <class Promise>
+    auto await_suspend(std::coroutine_handle<Promise> consumer) noexcept {
+      _h.promise()._consumer = consumer;
+      pmss::inherit_priority(_h.promise(), consumer);
+      return _h;
+    }
+
+    std::optional<T> await_resume() {
+#if __cpp_exceptions
+      if (_h.promise()._exception)
+        std::rethrow_exception(std::exchange(_h.promise()._exception, nullptr));
+#endif
+      std::optional<T> r = std::move(_h.promise()._value);
+      _h.promise()._value.reset();
+      return r;
+    }
+    handle _h;
+  };
+
+  // 上一次next()返回之前不能再次调用
+  next_awaiter next() {
+    assert(_h);
+    return next_awaiter{_h};
+  }
+
+  bool done() { return _h.done(); }
+};
+
+#endif  // _GENERATOR_H
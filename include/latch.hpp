@@ -0,0 +1,174 @@
+#ifndef ASYNC_SIMPLE_CORO_LATCH_H
+#define ASYNC_SIMPLE_CORO_LATCH_H
+
+#include <atomic>
+#include <cassert>
+#include <coroutine>
+#include "rcu.hpp"
+#include "schedule.hpp"
+
+namespace async_simple {
+namespace coro {
+
+// 一次性的倒计时门闩，计数减到0之后唤醒所有等待者，之后的wait()直接返回
+//
+// 等待者链表和Notifier一样：nullptr表示没有等待者，this表示已经打开，
+// 其他值是awaiter组成的栈。等待者在自己挂起时所在的线程上恢复。
+class Latch {
+ private:
+  class WaitAwaiter;
+
+ public:
+  explicit Latch(long expected) noexcept
+      : _count(expected), _waiters(expected > 0 ? nullptr : this) {}
+
+  Latch(const Latch&) = delete;
+  Latch& operator=(const Latch&) = delete;
+
+  void countDown(long update = 1) noexcept {
+    long prev = _count.fetch_sub(update, std::memory_order_acq_rel);
+    assert(prev >= update);
+    if (prev == update)
+      open();
+  }
+
+  bool tryWait() const noexcept {
+    return _count.load(std::memory_order_acquire) <= 0;
+  }
+
+  [[nodiscard]] WaitAwaiter wait() noexcept;
+
+  [[nodiscard]] WaitAwaiter arriveAndWait(long update = 1) noexcept;
+
+ private:
+  class WaitAwaiter {
+   public:
+    explicit WaitAwaiter(Latch& latch) noexcept : _latch(latch) {}
+
+    bool await_ready() const noexcept {
+      return _latch._waiters.load(std::memory_order_acquire) == &_latch;
+    }
+
+    bool await_suspend(std::coroutine_handle<> h) noexcept {
+      _h = h;
+      _thread = spdk_get_thread();
+      void* head = _latch._waiters.load(std::memory_order_acquire);
+      do {
+        if (head == &_latch)
+          return false;
+        _next = static_cast<WaitAwaiter*>(head);
+      } while (!_latch._waiters.compare_exchange_weak(
+          head, this, std::memory_order_release, std::memory_order_acquire));
+      pmss::rcu::rcu_offline();
+      return true;
+    }
+
+    void await_resume() noexcept {}
+
+   private:
+    friend Latch;
+    Latch& _latch;
+    std::coroutine_handle<> _h;
+    spdk_thread* _thread;
+    WaitAwaiter* _next;
+  };
+
+  void open() noexcept {
+    void* head = _waiters.exchange(this, std::memory_order_acq_rel);
+    auto* w = static_cast<WaitAwaiter*>(head);
+    while (w) {
+      // resume之后awaiter可能就析构了
+      WaitAwaiter* next = w->_next;
+      pmss::resume_on(w->_thread, w->_h);
+      w = next;
+    }
+  }
+
+  std::atomic<long> _count;
+  std::atomic<void*> _waiters;
+};
+
+inline Latch::WaitAwaiter Latch::wait() noexcept {
+  return WaitAwaiter(*this);
+}
+
+inline Latch::WaitAwaiter Latch::arriveAndWait(long update) noexcept {
+  countDown(update);
+  return WaitAwaiter(*this);
+}
+
+// 可重复使用的屏障，每一轮expected个协程都到达之后一起继续
+//
+// 到达的协程先把自己压进等待者栈，再减计数，所以最后一个到达的协程减到0时，
+// 本轮其他协程一定都已经入栈。最后一个到达的协程取走整个栈、重置计数，
+// 然后在各自的线程上恢复其他协程，自己不挂起直接继续。
+// 下一轮的协程只有在被恢复之后才能再次到达，不会混进本轮的栈里。
+class Barrier {
+ private:
+  class ArriveAwaiter;
+
+ public:
+  explicit Barrier(long expected) noexcept
+      : _expected(expected), _remaining(expected), _waiters(nullptr) {
+    assert(expected > 0);
+  }
+
+  Barrier(const Barrier&) = delete;
+  Barrier& operator=(const Barrier&) = delete;
+
+  [[nodiscard]] ArriveAwaiter arriveAndWait() noexcept;
+
+ private:
+  class ArriveAwaiter {
+   public:
+    explicit ArriveAwaiter(Barrier& barrier) noexcept : _barrier(barrier) {}
+
+    bool await_ready() const noexcept { return false; }
+
+    bool await_suspend(std::coroutine_handle<> h) noexcept {
+      _h = h;
+      _thread = spdk_get_thread();
+      ArriveAwaiter* head = _barrier._waiters.load(std::memory_order_relaxed);
+      do {
+        _next = head;
+      } while (!_barrier._waiters.compare_exchange_weak(
+          head, this, std::memory_order_release, std::memory_order_relaxed));
+      if (_barrier._remaining.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+        pmss::rcu::rcu_offline();
+        return true;
+      }
+      // 最后一个到达
+      ArriveAwaiter* w =
+          _barrier._waiters.exchange(nullptr, std::memory_order_acquire);
+      _barrier._remaining.store(_barrier._expected, std::memory_order_release);
+      while (w) {
+        ArriveAwaiter* next = w->_next;
+        if (w != this)
+          pmss::resume_on(w->_thread, w->_h);
+        w = next;
+      }
+      return false;
+    }
+
+    void await_resume() noexcept {}
+
+   private:
+    Barrier& _barrier;
+    std::coroutine_handle<> _h;
+    spdk_thread* _thread;
+    ArriveAwaiter* _next;
+  };
+
+  const long _expected;
+  std::atomic<long> _remaining;
+  std::atomic<ArriveAwaiter*> _waiters;
+};
+
+inline Barrier::ArriveAwaiter Barrier::arriveAndWait() noexcept {
+  return ArriveAwaiter(*this);
+}
+
+}  // namespace coro
+}  // namespace async_simple
+
+#endif  // ASYNC_SIMPLE_CORO_LATCH_H
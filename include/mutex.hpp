@@ -28,6 +28,7 @@
 #include <coroutine>
 #include <mutex>
 #include "rcu.hpp"
+#include "schedule.hpp"
 
 namespace async_simple {
 namespace coro {
@@ -39,7 +40,13 @@ class Mutex {
 
  public:
   /// Construct a new async mutex that is initially unlocked.
-  Mutex() noexcept : _state(unlockedState()), _waiters(nullptr) {}
+  ///
+  /// 默认handoff为true：unlock()把锁交给下一个等待者之后，在等待者挂起时
+  /// 所在的spdk_thread上恢复它（同一个线程时直接resume）。
+  /// handoff为false时等待者直接在解锁的线程上恢复，延迟更低，
+  /// 但是等待者会迁移到解锁者的reactor上，并且嵌套在unlock()里面运行。
+  explicit Mutex(bool handoff = true) noexcept
+      : _state(unlockedState()), _waiters(nullptr), _handoff(handoff) {}
 
   Mutex(const Mutex&) = delete;
   Mutex(Mutex&&) = delete;
@@ -133,7 +140,11 @@ class Mutex {
     }
     assert(waitersHead != nullptr);
     _waiters = waitersHead->_next;
-    waitersHead->_awaitingCoroutine.resume();
+    // 锁的所有权已经交给waitersHead，之后不能再访问this
+    if (_handoff)
+      pmss::resume_on(waitersHead->_thread, waitersHead->_awaitingCoroutine);
+    else
+      pmss::trampoline_resume(waitersHead->_awaitingCoroutine);
   }
 
  private:
@@ -145,6 +156,7 @@ class Mutex {
 
     bool await_suspend(std::coroutine_handle<> awaitingCoroutine) noexcept {
       _awaitingCoroutine = awaitingCoroutine;
+      _thread = spdk_get_thread();
       return _mutex.lockAsyncImpl(this);
     }
 
@@ -160,6 +172,8 @@ class Mutex {
     friend Mutex;
 
     std::coroutine_handle<> _awaitingCoroutine;
+    // 挂起时所在的线程，handoff模式下在这个线程上恢复
+    spdk_thread* _thread;
     LockAwaiter* _next;
   };
 
@@ -222,6 +236,8 @@ class Mutex {
   // Linked-list of waiters in FIFO order.
   // Only the current lock holder is allowed to access this member.
   LockAwaiter* _waiters;
+
+  bool _handoff;
 };
 
 inline Mutex::ScopedLockAwaiter Mutex::coScopedLock() noexcept {
@@ -24,22 +24,49 @@ void rcu_read_unlock();
 extern std::atomic<unsigned long> sequencer;
 extern unsigned long writer_version;
 
+// release保证v指向的对象在发布之前已经初始化完成
 template <typename T>
 static inline void rcu_assign_pointer(T*& p, T* v) {
-  *((volatile T**)&p) = v;
+  __atomic_store_n(&p, v, __ATOMIC_RELEASE);
 }
 
 template <typename T>
 static inline T* rcu_dereference(T*& p) {
-  return (T*)*((volatile T**)&p);
+  return __atomic_load_n(&p, __ATOMIC_CONSUME);
 }
 
 task<void> synchronize_rcu();
 
+// 轮询式宽限期：writer拿到一个cookie，和待回收的对象存在一起，
+// 之后用poll_state_synchronize_rcu检查宽限期是否已经结束，不需要挂起writer
+//
+// get_state_synchronize_rcu不会开启新的宽限期，只有在其它writer推进sequencer之后
+// 对应的cookie才会完成；start_poll_synchronize_rcu会推进sequencer开启一个新的宽限期
+unsigned long get_state_synchronize_rcu();
+
+unsigned long start_poll_synchronize_rcu();
+
+// 宽限期已经结束返回true，不能在读端临界区内调用
+bool poll_state_synchronize_rcu(unsigned long cookie);
+
+// 如果cookie对应的宽限期还没有结束，就等待它结束
+task<void> cond_synchronize_rcu(unsigned long cookie);
+
 void rcu_init();
 
+// 为每个reactor核分配独立cache line的读者状态，需要在spdk env初始化之后调用
+void rcu_attach_cores();
+
+void rcu_detach_cores();
+
 void rcu_offline();
 
+// 在宽限期之后调用func回收head，head需要是被回收对象的第一个成员
+void call_rcu(struct rcu_head* head, void (*func)(struct rcu_head* head));
+
+// 宽限期之后直接free(head)
+void free_rcu(struct rcu_head* head);
+
 void thread_call_rcu();
 }  // namespace rcu
 }  // namespace pmss
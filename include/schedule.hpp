@@ -3,62 +3,425 @@
 #pragma once
 
 #include <spdk/bdev.h>
+#include <spdk/env.h>
+#include <spdk/thread.h>
 #include "rcu.hpp"
 #include "module.hpp"
 #include <coroutine>
 #include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <deque>
+#include <exception>
+#include <future>
+#include <optional>
+#include <ranges>
+#include <string>
+#include <type_traits>
 #include <vector>
-#include <list>
 #include "task.hpp"
 
 // for scheduler
 namespace pmss {
+// 服务的启动参数，init_service(thread_num, ...)相当于核0..thread_num-1、
+// 不用大页、1GB内存
+struct service_options {
+  const char* config_file = nullptr;
+  const char* bdev_name = nullptr;
+  // 运行reactor的核，可以不连续，比如避开核0或者只用NVMe设备所在NUMA节点的核；
+  // round robin派发task时按这里的顺序
+  std::vector<uint32_t> cores;
+  // 生产环境应该打开：不用大页时DMA内存走普通页，I/O吞吐会明显下降
+  bool hugepages = false;
+  // DPDK预留的内存，单位MB
+  int mem_size = 1024;
+  // 大页的挂载目录，nullptr时由DPDK自己查找
+  const char* hugedir = nullptr;
+  // 主reactor所在的核，-1表示cores里编号最小的核
+  int main_core = -1;
+  // 每个核上创建几个spdk_thread，每个都有自己的io channel，task按round robin
+  // 派发到所有spdk_thread上。大于1时spdk_thread不再绑定在一个核上，
+  // SPDK的调度器（比如"dynamic"）可以把它们在reactor之间迁移：
+  // 负载高的核可以把一部分线程分出去，空闲的线程也可以合并到少数几个核上
+  int threads_per_core = 1;
+  // SPDK的调度器，nullptr时不改变（默认的"static"从不迁移线程）
+  const char* scheduler = nullptr;
+  // SPDK的中断模式：reactor空闲时阻塞在epoll上，不再占满整个核。
+  // 消息（yield和跨reactor的唤醒）、定时器（sleep_for）和入站队列都由fd唤醒
+  bool interrupt_mode = false;
+  // 中断模式下按负载在轮询和中断之间切换：每adaptive_period_us微秒统计一次
+  // 每个核上的唤醒次数，达到poll_wakeups切换到轮询模式，省掉epoll和eventfd
+  // 的开销；低于它的1/4时切换回中断模式。为0时一直用中断模式
+  uint64_t adaptive_period_us = 10000;
+  uint64_t poll_wakeups = 1000;
+  // 高低优先级都有yield之后就绪的协程时，每恢复这么多轮高优先级的协程
+  // 才恢复一个低优先级的，后台任务不会完全饿死；为0时严格按优先级
+  int high_priority_weight = 16;
+  // 每个spdk_thread上同时在飞的低优先级I/O最多这么多个，多出来的排队，
+  // 等前面的后台I/O完成再提交。高优先级的I/O总是直接提交，
+  // 在设备队列里最多只排在这么多个后台I/O后面
+  int background_io_depth = 8;
+};
+
 extern char device_name[64];
 extern char json_file[256];
-extern std::vector<task<int>> tasks;
-extern std::list<task<void>> wrapper_tasks;
+// 等待派发的task，已经包装成还没有开始运行的detached_task，不关心T是什么
+extern std::vector<detached_task> tasks;
 extern int num_threads;
-extern char cpumask[16];
+// 运行reactor的核，num_threads就是它的大小
+extern std::vector<uint32_t> reactor_cores;
+// 一共有几个spdk_thread，num_threads * threads_per_core
+extern int num_workers;
+// 传给spdk_app_start的reactor_mask，init_service时按cores生成
+extern std::string cpumask;
+extern service_options options;
 extern spdk_bdev_desc* desc;
 extern spdk_bdev* bdev;
 extern int alive_tasks;
 extern spdk_thread* main_thread;
+
 // for per-thread
-extern spdk_thread* threads[256];
-extern spdk_io_channel* channels[256];
-extern spdk_bdev_io_wait_entry wait_entries[256];
+struct result {
+  std::coroutine_handle<> coro;
+  int res;
+  // I/O结束（或者同步失败）之后置位，完成时还没有协程在等就只记下结果
+  bool done = false;
+};
+
+struct retry_context {
+  void* buf;
+  int len;
+  size_t offset;
+  result* res;
+};
+
+struct background_waiter;
+
+// 每个spdk_thread的状态，按编号索引，数组大小是num_workers。
+// 编号为k的spdk_thread创建在reactor_cores[k % num_threads]核上，
+// 编号0是主线程。不按核号索引：核可以不连续、编号也可以超过256，
+// 一个核上也可以有多个spdk_thread，并且它们可能被迁移到别的核上。
+// 每一项独占cache line，不同线程之间不会false sharing
+struct alignas(64) worker_state {
+  // 创建时所在的核，可以迁移时不一定是现在运行的核
+  uint32_t core;
+  spdk_thread* thread;
+  spdk_io_channel* channel;
+  // 每个优先级一个就绪队列，co_await yield()之后进入自己优先级的队列，
+  // 由一条drain消息按优先级成批恢复，队列不为空时才有这条消息
+  std::deque<std::coroutine_handle<>> ready[num_priorities];
+  bool drain_scheduled;
+  // 连续恢复了高优先级协程的轮数，到high_priority_weight时恢复一个低优先级的
+  int high_rounds;
+  // 在飞的低优先级I/O（包括低优先级scan的读请求），以及因为超过
+  // background_io_depth排队等待名额的，通过background_waiter的_next串起来
+  int background_inflight;
+  background_waiter* background_head;
+  background_waiter* background_tail;
+  // 被唤醒的次数（恢复协程的消息、I/O完成和定时器），只有自己的spdk_thread写，
+  // 主线程定期读取，决定这个核用轮询还是中断模式
+  std::atomic<uint64_t> wakeups;
+  // 常驻模式的入站队列：promise通过_next串起来的无锁栈，外部线程直接推到
+  // 目标spdk_thread的队列上，这个spdk_thread的poller一次全部取走。
+  // 外部线程会写它，单独放一个cache line，不影响上面I/O路径上读的字段
+  alignas(64) std::atomic<detached_task::promise_type*> inbound;
+  spdk_poller* inbound_poller;
+  // 中断模式下外部线程把task推到空队列上时写这个eventfd，不用的时候为-1
+  int inbound_fd;
+  spdk_interrupt* inbound_intr;
+};
+
+extern worker_state* workers;
+// spdk_thread的id到编号的映射，不是我们创建的spdk_thread为-1。
+// 用id而不用核号查找：迁移之后核变了，spdk_thread和它的io channel不变
+extern std::vector<int> thread_worker;
+
+// 当前spdk_thread的编号，不在我们的spdk_thread上时返回-1
+static inline int worker_index() {
+  spdk_thread* thread = spdk_get_thread();
+  if (thread == nullptr)
+    return -1;
+  uint64_t id = spdk_thread_get_id(thread);
+  return id < thread_worker.size() ? thread_worker[id] : -1;
+}
+
+// 只能在我们的spdk_thread上调用
+static inline worker_state& local_worker() {
+  int i = worker_index();
+  assert(i >= 0);
+  return workers[i];
+}
+
+// 自适应中断模式打开时才统计唤醒次数
+extern bool count_wakeups;
+// 各个核在轮询和中断模式之间切换的次数，只在主线程上修改
+extern uint64_t mode_switches;
+
+static inline void count_wakeup() {
+  if (!count_wakeups)
+    return;
+  int i = worker_index();
+  if (i < 0)
+    return;
+  // 只有一个写者，不需要原子的加法
+  auto& n = workers[i].wakeups;
+  n.store(n.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
 
 void service_thread_run_yield(void* args);
 
 void scheduler_init(void* args);
 
+// 把h放进当前spdk_thread上优先级为p的就绪队列
+void make_ready(worker_state& w, priority p, std::coroutine_handle<> h);
+
+// 让出reactor：排到同优先级的就绪协程后面，高优先级的协程先恢复
 struct YieldAwaiter {
   bool await_ready() noexcept { return false; }
+  template <class Promise>
+  void await_suspend(std::coroutine_handle<Promise> continuation) noexcept {
+    rcu::rcu_offline();
+    int i = worker_index();
+    if (i < 0) {
+      // 不是我们创建的spdk_thread，没有就绪队列
+      spdk_thread_send_msg(spdk_get_thread(), service_thread_run_yield,
+                           continuation.address());
+      return;
+    }
+    make_ready(workers[i], priority_of(continuation), continuation);
+  }
+  void await_resume() noexcept {}
+};
+
+// 至少挂起us微秒。用一次性的定时poller实现，中断模式下由timerfd唤醒，
+// 不像循环co_await yield()那样一直占着reactor
+struct SleepAwaiter {
+  bool await_ready() noexcept { return _us == 0; }
   void await_suspend(std::coroutine_handle<> continuation) noexcept {
+    _h = continuation;
     rcu::rcu_offline();
-    spdk_thread_send_msg(spdk_get_thread(), service_thread_run_yield,
-                         continuation.address());
+    _poller = spdk_poller_register(fire, this, _us);
   }
   void await_resume() noexcept {}
+
+  static int fire(void* arg) {
+    auto* self = static_cast<SleepAwaiter*>(arg);
+    // 先注销，恢复之后awaiter可能已经随协程帧一起销毁了
+    spdk_poller_unregister(&self->_poller);
+    count_wakeup();
+    trampoline_resume(self->_h);
+    return SPDK_POLLER_BUSY;
+  }
+
+  uint64_t _us;
+  spdk_poller* _poller = nullptr;
+  std::coroutine_handle<> _h;
 };
 
+// 在thread上恢复h：就在当前线程时通过trampoline恢复，否则发消息过去，
+// 这样协程总是在自己的reactor上运行，用的也是这个reactor的io channel
+static inline void resume_on(spdk_thread* thread, std::coroutine_handle<> h) {
+  if (thread == nullptr || thread == spdk_get_thread())
+    trampoline_resume(h);
+  else
+    spdk_thread_send_msg(thread, service_thread_run_yield, h.address());
+}
+
 void init_service(int thread_num, const char* config_file,
                   const char* bdev_name);
 
-void deinit_service();
+void init_service(const service_options& opts);
 
-void add_task(task<int>&& t);
+// init_service确定num_workers之后、创建spdk_thread之前调用hook(num_workers)。
+// 按spdk_thread编号分配状态、又可能在init_service之前创建的对象（比如BrLock）
+// 注册一个hook在这里重新分配，重复注册同一个hook只算一次
+void on_workers_resized(void (*hook)(int workers));
+
+service_options default_options(int thread_num, const char* config_file,
+                                const char* bdev_name);
+
+void deinit_service();
 
 void run();
 
-void run(task<int>&& t);
+void task_done(void* args);
+
+#if __cpp_exceptions
+void report_task_exception(std::exception_ptr e);
+#endif
 
+// 包装最外层的task：运行结束后把结果写到result里（抛出异常时不写），
+// 然后通知主线程这个task结束了
+template <class T>
+detached_task task_run(task<T> t, std::optional<T>* result) {
+#if __cpp_exceptions
+  // 一个task抛出的异常不能让整个app退出，记下来之后当作这个task结束
+  try {
+    T r = co_await t;
+    if (result)
+      result->emplace(std::move(r));
+  } catch (...) {
+    report_task_exception(std::current_exception());
+  }
+#else
+  T r = co_await t;
+  if (result)
+    result->emplace(std::move(r));
+#endif
+  rcu::rcu_offline();
+  spdk_thread_send_msg(main_thread, task_done, nullptr);
+}
+
+inline detached_task task_run(task<void> t) {
+#if __cpp_exceptions
+  try {
+    co_await t;
+  } catch (...) {
+    report_task_exception(std::current_exception());
+  }
+#else
+  co_await t;
+#endif
+  rcu::rcu_offline();
+  spdk_thread_send_msg(main_thread, task_done, nullptr);
+}
+
+// 添加一个任意返回类型的task，下一次run()时按round robin派发到各个核上，
+// result不为空时task的返回值写到*result里，run()返回之后可以读取。
+// 后台任务用add_task(t().with_priority(priority::low))，submit也一样
+template <class T>
+void add_task(task<T>&& t, std::optional<T>* result = nullptr) {
+  tasks.push_back(task_run(std::move(t), result));
+}
+
+inline void add_task(task<void>&& t) {
+  tasks.push_back(task_run(std::move(t)));
+}
+
+// 只运行t（以及之前add_task的task），返回t的结果
+template <class T>
+std::optional<T> run(task<T>&& t) {
+  std::optional<T> result;
+  add_task(std::move(t), &result);
+  run();
+  return result;
+}
+
+inline void run(task<void>&& t) {
+  add_task(std::move(t));
+  run();
+}
+
+// 常驻模式：start_service只启动一次SPDK app和所有reactor，之后不再退出，
+// 非SPDK线程通过submit()提交task，拿到std::future，可以在任何线程上等结果，
+// 不用每一批任务都重新初始化SPDK、打开bdev和创建io channel。
+// 常驻模式下不能再调用run()，stop_service()之前要等所有future都就绪
+void start_service(int thread_num, const char* config_file,
+                   const char* bdev_name);
+
+void start_service(const service_options& opts);
+
+void stop_service();
+
+// 把还没开始运行的detached_task放进编号为worker的spdk_thread的入站队列，
+// 任何线程都可以调用，只是一次无锁的CAS；那个spdk_thread上的poller成批取出
+// 之后直接在那里启动。不指定worker时按round robin选择
+void inject(int worker, detached_task::handle h);
+
+void inject(detached_task::handle h);
+
+// 先rcu_offline再兑现promise，并且这是最后一步：等future的线程拿到结果之后
+// 可能马上stop_service()，释放RCU的读者状态，之后这里不能再访问服务的状态。
+// 和task_run先offline再通知主线程是一样的
+template <class T>
+detached_task submit_run(task<T> t, std::promise<T> p) {
+  std::optional<T> value;
+#if __cpp_exceptions
+  // 异常交给等待future的线程处理
+  std::exception_ptr e;
+  try {
+    value.emplace(co_await t);
+  } catch (...) {
+    e = std::current_exception();
+  }
+  rcu::rcu_offline();
+  if (e)
+    p.set_exception(e);
+  else
+    p.set_value(std::move(*value));
+#else
+  value.emplace(co_await t);
+  rcu::rcu_offline();
+  p.set_value(std::move(*value));
+#endif
+}
+
+inline detached_task submit_run(task<void> t, std::promise<void> p) {
+#if __cpp_exceptions
+  std::exception_ptr e;
+  try {
+    co_await t;
+  } catch (...) {
+    e = std::current_exception();
+  }
+  rcu::rcu_offline();
+  if (e)
+    p.set_exception(e);
+  else
+    p.set_value();
+#else
+  co_await t;
+  rcu::rcu_offline();
+  p.set_value();
+#endif
+}
+
+template <class T>
+std::future<T> submit(task<T>&& t) {
+  std::promise<T> p;
+  std::future<T> f = p.get_future();
+  inject(submit_run(std::move(t), std::move(p))._h);
+  return f;
+}
+
+// 在编号为worker的spdk_thread上运行（threads_per_core为1时就是运行在
+// reactor_cores[worker]核上），task里的I/O直接用这个spdk_thread的io channel。
+// 和submit(t)一样，future就绪时这个spdk_thread已经不再访问服务的状态，
+// 外部线程池等到所有future之后可以直接stop_service()
+template <class T>
+std::future<T> submit(int worker, task<T>&& t) {
+  std::promise<T> p;
+  std::future<T> f = p.get_future();
+  inject(worker, submit_run(std::move(t), std::move(p))._h);
+  return f;
+}
+
+// 运行range里所有的task，按顺序返回每个task的结果，抛出异常的task为std::nullopt
 template <typename Range>
-void run_all(Range& range);
+auto run_all(Range& range) {
+  using T = typename std::ranges::range_value_t<Range>::value_type;
+  if constexpr (std::is_void_v<T>) {
+    for (auto& element : range)
+      add_task(std::move(element));
+    run();
+  } else {
+    // 先分配好，之后各个核直接写自己的那一项
+    std::vector<std::optional<T>> results(std::ranges::distance(range));
+    size_t i = 0;
+    for (auto& element : range)
+      add_task(std::move(element), &results[i++]);
+    run();
+    return results;
+  }
+}
 };  // namespace pmss
 
 static inline struct pmss::YieldAwaiter yield() {
   return pmss::YieldAwaiter{};
 }
 
+static inline struct pmss::SleepAwaiter sleep_for(uint64_t us) {
+  return pmss::SleepAwaiter{us};
+}
+
 #endif  // !SCHEDULE_HPP_
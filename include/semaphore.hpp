@@ -0,0 +1,141 @@
+#ifndef ASYNC_SIMPLE_CORO_SEMAPHORE_H
+#define ASYNC_SIMPLE_CORO_SEMAPHORE_H
+
+#include <atomic>
+#include <cassert>
+#include <coroutine>
+#include "rcu.hpp"
+#include "schedule.hpp"
+#include "spinlock.hpp"
+
+namespace async_simple {
+namespace coro {
+
+// 协程计数信号量，用于准入控制（比如限制同时在飞的I/O数）
+//
+// _count大于0时表示剩余的许可数，小于0时它的绝对值是等待者（包括正在入队的）
+// 个数。coAcquire()先做一次fetch_sub，拿到许可就直接返回，不挂起也不分配内存；
+// 否则把awaiter挂到FIFO链表上。release()先做一次fetch_add，发现有等待者时
+// 才去拿_guard取出一个等待者，在它自己的线程上恢复它。
+// 等待者可能已经减了_count但还没来得及入队，这时release()记到_pending里，
+// 等待者入队之前看到_pending就直接拿走这个许可。
+class CountingSemaphore {
+ private:
+  class AcquireAwaiter;
+
+ public:
+  explicit CountingSemaphore(long desired) noexcept
+      : _count(desired),
+        _guard(false),
+        _head(nullptr),
+        _tail(nullptr),
+        _pending(0) {}
+
+  CountingSemaphore(const CountingSemaphore&) = delete;
+  CountingSemaphore& operator=(const CountingSemaphore&) = delete;
+
+  ~CountingSemaphore() { assert(_head == nullptr); }
+
+  bool tryAcquire() noexcept {
+    long c = _count.load(std::memory_order_relaxed);
+    while (c > 0) {
+      if (_count.compare_exchange_weak(c, c - 1, std::memory_order_acquire,
+                                       std::memory_order_relaxed))
+        return true;
+    }
+    return false;
+  }
+
+  [[nodiscard]] AcquireAwaiter coAcquire() noexcept;
+
+  void release(long update = 1) noexcept {
+    for (long i = 0; i < update; ++i) {
+      if (_count.fetch_add(1, std::memory_order_release) < 0)
+        wakeOne();
+    }
+  }
+
+  // 当前剩余的许可数，只用于统计
+  long available() const noexcept {
+    long c = _count.load(std::memory_order_relaxed);
+    return c > 0 ? c : 0;
+  }
+
+ private:
+  class AcquireAwaiter {
+   public:
+    explicit AcquireAwaiter(CountingSemaphore& sem) noexcept : _sem(sem) {}
+
+    bool await_ready() noexcept {
+      return _sem._count.fetch_sub(1, std::memory_order_acquire) > 0;
+    }
+
+    bool await_suspend(std::coroutine_handle<> h) noexcept {
+      _h = h;
+      _thread = spdk_get_thread();
+      _next = nullptr;
+      _sem.lockGuard();
+      if (_sem._pending > 0) {
+        --_sem._pending;
+        _sem.unlockGuard();
+        return false;
+      }
+      if (_sem._tail)
+        _sem._tail->_next = this;
+      else
+        _sem._head = this;
+      _sem._tail = this;
+      _sem.unlockGuard();
+      pmss::rcu::rcu_offline();
+      return true;
+    }
+
+    void await_resume() noexcept {}
+
+   private:
+    friend CountingSemaphore;
+    CountingSemaphore& _sem;
+    std::coroutine_handle<> _h;
+    spdk_thread* _thread;
+    AcquireAwaiter* _next;
+  };
+
+  void lockGuard() noexcept {
+    while (_guard.exchange(true, std::memory_order_acquire))
+      cpuRelax();
+  }
+
+  void unlockGuard() noexcept { _guard.store(false, std::memory_order_release); }
+
+  void wakeOne() noexcept {
+    lockGuard();
+    AcquireAwaiter* w = _head;
+    if (w) {
+      _head = w->_next;
+      if (_head == nullptr)
+        _tail = nullptr;
+    } else {
+      ++_pending;
+    }
+    unlockGuard();
+    if (w)
+      pmss::resume_on(w->_thread, w->_h);
+  }
+
+  std::atomic<long> _count;
+  std::atomic<bool> _guard;
+  // 以下成员由_guard保护
+  AcquireAwaiter* _head;
+  AcquireAwaiter* _tail;
+  long _pending;
+};
+
+inline CountingSemaphore::AcquireAwaiter
+CountingSemaphore::coAcquire() noexcept {
+  return AcquireAwaiter(*this);
+}
+
+}  // namespace coro
+}  // namespace async_simple
+
+#endif  // ASYNC_SIMPLE_CORO_SEMAPHORE_H
@@ -6,6 +6,7 @@
 #include "spdk/cpuset.h"
 #include "spdk/env.h"
 #include "spdk/event.h"
+#include "generator.hpp"
 #include "task.hpp"
 #include <algorithm>
 #include <cassert>
@@ -22,33 +23,68 @@
 
 namespace pmss {
 // data structure
-struct result {
-  std::coroutine_handle<> coro;
-  int res;
+// 等待后台I/O名额：低优先级的读写和scan的读请求在同一个spdk_thread上
+// 共用background_io_depth个名额，没有名额时排在worker_state的队列上，
+// 前面的后台I/O完成之后按顺序调用_admit，这时名额已经算在它头上了
+struct background_waiter {
+  void (*_admit)(background_waiter*) = nullptr;
+  background_waiter* _next = nullptr;
 };
 
-struct retry_context {
-  void* buf;
-  int len;
-  size_t offset;
-  result* res;
-};
+// 有名额时占用一个并返回true，否则把w排进队列，返回false
+bool acquire_background_io(background_waiter* w);
+// 一个后台I/O完成，释放它的名额，按顺序交给排队的请求
+void background_io_done();
 
-struct service_awaiter {
+struct service_awaiter;
+bool submit_io(service_awaiter* awaiter);
+
+// read()/write()的请求在co_await的时候才提交，这时才知道发起I/O的协程的
+// 优先级：高优先级的直接提交，低优先级的受background_io_depth限制，
+// 超过的先排队，等前面的后台I/O完成再提交。
+// start_read()/start_write()的请求构造时就提交，co_await只是等它完成
+struct service_awaiter : background_waiter {
   result res;
-  bool ready;
-  bool await_ready() { return ready; }
-  auto await_suspend(std::coroutine_handle<> coro) { res.coro = coro; }
-  auto await_resume() { return res.res; }
-  explicit service_awaiter() : ready(false) {}
-  void set_failure(int rc) {
-    res.res = rc;
-    ready = true;
+  retry_context retry;
+  spdk_bdev_io_wait_entry wait_entry;
+  bool is_write;
+  bool background;
+  bool submitted;
+  bool await_ready() { return res.done; }
+  // 同步失败时返回false，不挂起，直接从await_resume拿到错误码
+  template <class Promise>
+  bool await_suspend(std::coroutine_handle<Promise> coro) {
+    res.coro = coro;
+    if (submitted)
+      return true;
+    background = priority_of(coro) == priority::low;
+    return submit_io(this);
+  }
+  int await_resume() {
+    if (background)
+      background_io_done();
+    return res.res;
   }
+  service_awaiter(void* buf, int len, size_t offset, bool write,
+                  bool eager = false)
+      : res{nullptr, 0},
+        retry{buf, len, offset, &res},
+        is_write(write),
+        background(false),
+        submitted(eager) {
+    if (eager)
+      submit_io(this);
+  }
+  // 完成回调会写res，提交了的请求完成之前awaiter不能销毁
+  ~service_awaiter() { assert(!submitted || res.done); }
+  // retry.res指向自己的res，复制之后会指向原来的对象。read()/write()
+  // 直接返回prvalue，co_await的时候也不需要复制
+  service_awaiter(const service_awaiter&) = delete;
+  service_awaiter(service_awaiter&&) = delete;
+  service_awaiter& operator=(const service_awaiter&) = delete;
+  service_awaiter& operator=(service_awaiter&&) = delete;
 };
 
-extern retry_context retry_contexts[256];
-
 // define api
 void spdk_io_complete_cb(struct spdk_bdev_io* bdev_io, bool success,
                          void* cb_arg);
@@ -57,9 +93,44 @@ void spdk_retry_read(void* args);
 
 void spdk_retry_write(void* args);
 
+// 注意：请求在co_await返回的awaiter时才提交，调用read()/write()本身不会
+// 发出I/O，低优先级的协程才能受background_io_depth的限制。
+// 先发起几个I/O再一起等待用start_read()/start_write()，
+// 顺序读一段范围用scan()。buf必须是DMA内存
 service_awaiter read(void* buf, int len, size_t offset);
 
 service_awaiter write(void* buf, int len, size_t offset);
+
+// 调用时就提交（以前read()/write()的行为），可以先发起几个I/O再依次
+// co_await拿结果：
+//   auto a = pmss::start_read(buf0, 4096, 0);
+//   auto b = pmss::start_read(buf1, 4096, 4096);
+//   int rc = co_await a + co_await b;
+// 调用时不知道协程的优先级，总是直接提交，不占background_io_depth的名额。
+// 返回的awaiter不能复制或移动，要在同一个spdk_thread上co_await，
+// 并且I/O完成之前不能销毁
+service_awaiter start_read(void* buf, int len, size_t offset);
+
+service_awaiter start_write(void* buf, int len, size_t offset);
+
+// scan产生的一块数据，buf在消费者下一次调用next()之前有效
+struct scan_block {
+  size_t offset;
+  void* buf;
+  int len;
+  // 0表示成功，失败时是负的errno：提交失败时是bdev返回的错误码，
+  // 读请求本身失败时是-EIO
+  int res;
+};
+
+// 按顺序流式读取[offset, offset + len)，每块block_size字节，
+// 始终保持depth个读请求在消费者前面，读完一块就co_yield一块，
+// 消费者不用等整个范围读完就可以开始处理。
+// offset和block_size必须是设备块大小的整数倍，否则只产生一块res为-EINVAL、
+// buf为空的结果；len可以不对齐，最后一块向上取整到设备块读出来，
+// 不超出设备的话res为0，scan_block的len仍然是范围内的字节数
+async_generator<scan_block> scan(size_t offset, size_t len, int block_size,
+                                 int depth);
 };  // namespace pmss
 
 #endif
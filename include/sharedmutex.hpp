@@ -18,8 +18,11 @@
 #include "mutex.hpp"
 #include "spinlock.hpp"
 #include "task.hpp"
+#include <atomic>
 #include <cassert>
 #include <climits>
+#include <coroutine>
+#include <optional>
 
 namespace async_simple::coro {
 
@@ -50,122 +53,218 @@ class SharedMutexBase {
   // priority and no more reader locks can be taken while the writer is
   // queued.
 
-  // Only locked when accessing state_ or waiting on condition variables.
+  // 读者的加锁和解锁只在state_上做一次原子操作，写者在没有竞争时也只做一次
+  // 原子操作，都不会挂起，也不会分配协程帧。
+  // 只有需要等待的时候才会去拿mut_并在条件变量上等待，等待之前先置位waiters，
+  // 写者解锁时看到waiters才去mut_下唤醒gate1_。
+  // 条件变量的谓词在mut_下重新检查，置位waiters之后会再检查一次，
+  // 所以不会丢失唤醒。
+
+  // Only locked when waiting on condition variables or notifying them.
   Lock mut_;
   // Used to block while write-entered is set or reader count at maximum.
   ConditionVariable<Lock> gate1_;
   // Used to block queued writers while reader count is non-zero.
   ConditionVariable<Lock> gate2_;
-  // The write-entered flag and reader count.
-  unsigned state_;
+  // The write-entered flag, waiters flag and reader count.
+  std::atomic<unsigned> state_;
 
   static constexpr unsigned write_entered_flag =
       1U << (sizeof(unsigned) * CHAR_BIT - 1);
-  static constexpr unsigned max_readers = ~write_entered_flag;
-
-  // Test whether the write-entered flag is set. mut_ must be locked.
-  bool write_entered() const noexcept { return state_ & write_entered_flag; }
+  // 有协程在gate1_上等待
+  static constexpr unsigned waiters_flag = write_entered_flag >> 1;
+  static constexpr unsigned max_readers = waiters_flag - 1;
 
-  // The number of reader locks currently held. mut_ must be locked.
-  unsigned readers() const noexcept { return state_ & max_readers; }
+  // Test whether the write-entered flag is set.
+  bool write_entered() const noexcept {
+    return state_.load(std::memory_order_acquire) & write_entered_flag;
+  }
 
- public:
-  template <typename... Args>
-  SharedMutexBase(Args&&... args)
-      : mut_(std::forward<Args>(args)...), state_(0) {}
+  // The number of reader locks currently held.
+  unsigned readers() const noexcept {
+    return state_.load(std::memory_order_acquire) & max_readers;
+  }
 
-  ~SharedMutexBase() { assert(state_ == 0); }
+  void markWaiting() noexcept {
+    state_.fetch_or(waiters_flag, std::memory_order_relaxed);
+  }
 
-  SharedMutexBase(const SharedMutexBase&) = delete;
-  SharedMutexBase& operator=(const SharedMutexBase&) = delete;
+  // 没有写者并且读者数没到上限时加读锁
+  bool tryLockSharedFast() noexcept {
+    unsigned s = state_.load(std::memory_order_relaxed);
+    while (!(s & write_entered_flag) && (s & max_readers) < max_readers) {
+      if (state_.compare_exchange_weak(s, s + 1, std::memory_order_acquire,
+                                       std::memory_order_relaxed))
+        return true;
+    }
+    return false;
+  }
 
-  // Exclusive ownership
+  // 没有其他写者时置位write-entered
+  bool trySetWriteEntered() noexcept {
+    unsigned s = state_.load(std::memory_order_relaxed);
+    while (!(s & write_entered_flag)) {
+      if (state_.compare_exchange_weak(s, s | write_entered_flag,
+                                       std::memory_order_acquire,
+                                       std::memory_order_relaxed))
+        return true;
+    }
+    return false;
+  }
 
-  task<int> coLock() noexcept {
-    // auto scoper = co_await mut_.coScopedLock();
+  task<int> lockSlow() {
     co_await mut_.coLock();
     // Wait until we can set the write-entered flag.
-    if (write_entered()) {
-      co_await gate1_.wait(mut_, [this] { return !write_entered(); });
-    }
-    state_ |= write_entered_flag;
+    co_await gate1_.wait(mut_, [this] {
+      return trySetWriteEntered() || (markWaiting(), trySetWriteEntered());
+    });
     // Then wait until there are no more readers.
-    if (readers() != 0) {
-      co_await gate2_.wait(mut_, [this] { return readers() == 0; });
-    }
+    co_await gate2_.wait(mut_, [this] { return readers() == 0; });
     mut_.unlock();
     co_return 0;
   }
 
-  bool tryLock() noexcept {
-    if (!mut_.tryLock()) {
-      return false;
-    }
-    bool allow_write = (state_ == 0);
-    if (allow_write) {
-      state_ = write_entered_flag;
-    }
-    mut_.unlock();
-    return allow_write;
-  }
-
-  task<int> unlock() noexcept {
-    // auto scoper = co_await mut_.coScopedLock();
+  task<int> unlockSlow() {
     co_await mut_.coLock();
-    assert(write_entered());
-    state_ = 0;
-    // call notify_all() while mutex is held so that another thread can't
-    // lock and unlock the mutex then destroy *this before we make the call.
     gate1_.notifyAll();
     mut_.unlock();
     co_return 0;
   }
 
-  // Shared ownership
-
-  task<int> coLockShared() {
-    // auto scoper = co_await mut_.coScopedLock();
+  task<int> lockSharedSlow() {
     co_await mut_.coLock();
-    if (state_ >= max_readers) {
-      co_await gate1_.wait(mut_, [this] { return state_ < max_readers; });
-    }
-    ++state_;
+    co_await gate1_.wait(mut_, [this] {
+      return tryLockSharedFast() || (markWaiting(), tryLockSharedFast());
+    });
     mut_.unlock();
     co_return 0;
   }
 
-  bool tryLockShared() {
-    if (!mut_.tryLock()) {
-      return false;
-    }
-    bool allow_read = (state_ < max_readers);
-    if (allow_read) {
-      ++state_;
-    }
-    mut_.unlock();
-    return allow_read;
-  }
-
-  task<int> unlockShared() {
-    // auto scoper = co_await mut_.coScopedLock();
+  task<int> unlockSharedSlow(unsigned prev) {
     co_await mut_.coLock();
-    assert(readers() > 0);
-    auto prev = state_--;
-    if (write_entered()) {
+    if (prev & write_entered_flag) {
       // Wake the queued writer if there are no more readers.
-      if (readers() == 0)
-        gate2_.notifyOne();
+      gate2_.notifyOne();
       // No need to notify gate1_ because we give priority to the queued
       // writer, and that writer will eventually notify gate1_ after it
       // clears the write-entered flag.
     } else {
       // Wake any thread that was blocked on reader overflow.
-      if (prev == max_readers)
-        gate1_.notifyOne();
+      gate1_.notifyOne();
     }
     mut_.unlock();
     co_return 0;
   }
+
+  class LockAwaiter : public slow_path_awaiter {
+   public:
+    explicit LockAwaiter(SharedMutexBase& m) noexcept : _m(m) {}
+    bool await_ready() noexcept {
+      if (_m.tryLock())
+        return true;
+      _slow.emplace(_m.lockSlow());
+      return false;
+    }
+
+   private:
+    SharedMutexBase& _m;
+  };
+
+  class UnlockAwaiter : public slow_path_awaiter {
+   public:
+    explicit UnlockAwaiter(SharedMutexBase& m) noexcept : _m(m) {}
+    bool await_ready() noexcept {
+      // 持有写锁时读者数一定是0
+      unsigned prev = _m.state_.exchange(0, std::memory_order_release);
+      assert(prev & write_entered_flag);
+      if (!(prev & waiters_flag))
+        return true;
+      _slow.emplace(_m.unlockSlow());
+      return false;
+    }
+
+   private:
+    SharedMutexBase& _m;
+  };
+
+  class SharedLockAwaiter : public slow_path_awaiter {
+   public:
+    explicit SharedLockAwaiter(SharedMutexBase& m) noexcept : _m(m) {}
+    bool await_ready() noexcept {
+      if (_m.tryLockSharedFast())
+        return true;
+      _slow.emplace(_m.lockSharedSlow());
+      return false;
+    }
+
+   private:
+    SharedMutexBase& _m;
+  };
+
+  class SharedUnlockAwaiter : public slow_path_awaiter {
+   public:
+    explicit SharedUnlockAwaiter(SharedMutexBase& m) noexcept : _m(m) {}
+    bool await_ready() noexcept {
+      unsigned prev = _m.state_.fetch_sub(1, std::memory_order_release);
+      assert((prev & max_readers) > 0);
+      // 最后一个读者需要唤醒等待的写者，读者数从上限降下来时需要唤醒等待的读者
+      bool notify = (prev & write_entered_flag)
+                        ? (prev & max_readers) == 1
+                        : (prev & max_readers) == max_readers;
+      if (!notify)
+        return true;
+      _slow.emplace(_m.unlockSharedSlow(prev));
+      return false;
+    }
+
+   private:
+    SharedMutexBase& _m;
+  };
+
+ public:
+  template <typename... Args>
+  SharedMutexBase(Args&&... args)
+      : mut_(std::forward<Args>(args)...), state_(0) {}
+
+  ~SharedMutexBase() {
+    assert((state_.load(std::memory_order_relaxed) & ~waiters_flag) == 0);
+  }
+
+  SharedMutexBase(const SharedMutexBase&) = delete;
+  SharedMutexBase& operator=(const SharedMutexBase&) = delete;
+
+  // Exclusive ownership
+
+  // 没有竞争时只做一次CAS
+  [[nodiscard]] LockAwaiter coLock() noexcept { return LockAwaiter(*this); }
+
+  bool tryLock() noexcept {
+    unsigned s = state_.load(std::memory_order_relaxed);
+    while ((s & ~waiters_flag) == 0) {
+      if (state_.compare_exchange_weak(s, s | write_entered_flag,
+                                       std::memory_order_acquire,
+                                       std::memory_order_relaxed))
+        return true;
+    }
+    return false;
+  }
+
+  // 没有等待者时只做一次exchange
+  [[nodiscard]] UnlockAwaiter unlock() noexcept { return UnlockAwaiter(*this); }
+
+  // Shared ownership
+
+  // 没有写者时只做一次CAS
+  [[nodiscard]] SharedLockAwaiter coLockShared() noexcept {
+    return SharedLockAwaiter(*this);
+  }
+
+  bool tryLockShared() noexcept { return tryLockSharedFast(); }
+
+  // 只做一次fetch_sub，只有需要唤醒其他协程时才会去拿mut_
+  [[nodiscard]] SharedUnlockAwaiter unlockShared() noexcept {
+    return SharedUnlockAwaiter(*this);
+  }
 };
 
 struct SharedMutex : public SharedMutexBase<SpinLock> {
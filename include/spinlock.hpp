@@ -26,6 +26,9 @@ namespace async_simple {
 namespace coro {
 
 class SpinLock {
+ private:
+  class LockAwaiter;
+
  public:
   explicit SpinLock(std::int32_t count = 1024) noexcept
       : _spinCount(count), _locked(false) {}
@@ -34,7 +37,27 @@ class SpinLock {
     return !_locked.exchange(true, std::memory_order_acquire);
   }
 
-  task<int> coLock() noexcept {
+  // 没有竞争时在await_ready里直接拿到锁，不会分配协程帧
+  [[nodiscard]] LockAwaiter coLock() noexcept;
+
+  void unlock() noexcept { _locked.store(false, std::memory_order_release); }
+
+ private:
+  class LockAwaiter : public slow_path_awaiter {
+   public:
+    explicit LockAwaiter(SpinLock& lock) noexcept : _lock(lock) {}
+    bool await_ready() noexcept {
+      if (_lock.tryLock())
+        return true;
+      _slow.emplace(_lock.coLockSlow());
+      return false;
+    }
+
+   private:
+    SpinLock& _lock;
+  };
+
+  task<int> coLockSlow() noexcept {
     auto counter = _spinCount;
     while (!tryLock()) {
       while (_locked.load(std::memory_order_relaxed)) {
@@ -47,13 +70,152 @@ class SpinLock {
     co_return 0;
   }
 
-  void unlock() noexcept { _locked.store(false, std::memory_order_release); }
+  std::int32_t _spinCount;
+  std::atomic<bool> _locked;
+};
+
+inline SpinLock::LockAwaiter SpinLock::coLock() noexcept {
+  return LockAwaiter(*this);
+}
+
+static inline void cpuRelax() noexcept {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#elif defined(__aarch64__)
+  __asm__ __volatile__("yield" ::: "memory");
+#endif
+}
 
+// MCS风格的排队自旋锁，按FIFO顺序把锁直接交给下一个等待者
+//
+// 队列节点放在等待者的LockAwaiter里（也就是协程帧里），每个等待者只在自己的
+// 节点上自旋，不会和其他核抢同一条cache line。自旋超过spinCount次之后挂起，
+// 轮到它时由解锁者在它自己的线程上恢复。
+//
+// LockAwaiter在co_await结束之后就析构了，所以拿到锁之后要把自己在队列里的
+// 位置转移到锁内部的_holder节点上，unlock()只通过_holder找后继。
+class QueuedSpinLock {
  private:
+  class LockAwaiter;
+
+  enum : int { WAITING, GRANTED, PARKED };
+
+  struct Node {
+    std::atomic<Node*> next;
+    std::atomic<int> state;
+    std::coroutine_handle<> coro;
+    spdk_thread* thread;
+  };
+
+ public:
+  explicit QueuedSpinLock(std::int32_t count = 1024) noexcept
+      : _spinCount(count), _tail(nullptr) {
+    _holder.next.store(nullptr, std::memory_order_relaxed);
+  }
+
+  QueuedSpinLock(const QueuedSpinLock&) = delete;
+  QueuedSpinLock& operator=(const QueuedSpinLock&) = delete;
+
+  bool tryLock() noexcept {
+    Node* expected = nullptr;
+    return _tail.compare_exchange_strong(expected, &_holder,
+                                         std::memory_order_acquire,
+                                         std::memory_order_relaxed);
+  }
+
+  [[nodiscard]] LockAwaiter coLock() noexcept;
+
+  void unlock() noexcept {
+    Node* succ = _holder.next.load(std::memory_order_acquire);
+    if (succ == nullptr) {
+      Node* expected = &_holder;
+      if (_tail.compare_exchange_strong(expected, nullptr,
+                                        std::memory_order_release,
+                                        std::memory_order_relaxed))
+        return;
+      // 有新的等待者已经入队，但还没有把自己链到_holder后面
+      while ((succ = _holder.next.load(std::memory_order_acquire)) == nullptr)
+        cpuRelax();
+    }
+    // 改成GRANTED之后等待者随时可能析构节点，所以先把需要的字段读出来
+    std::coroutine_handle<> coro = succ->coro;
+    spdk_thread* thread = succ->thread;
+    if (succ->state.exchange(GRANTED, std::memory_order_acq_rel) == PARKED)
+      pmss::resume_on(thread, coro);
+  }
+
+ private:
+  class LockAwaiter {
+   public:
+    explicit LockAwaiter(QueuedSpinLock& lock) noexcept
+        : _lock(lock), _fast(false) {}
+
+    bool await_ready() noexcept {
+      _fast = _lock.tryLock();
+      return _fast;
+    }
+
+    bool await_suspend(std::coroutine_handle<> coro) noexcept {
+      _node.next.store(nullptr, std::memory_order_relaxed);
+      _node.state.store(WAITING, std::memory_order_relaxed);
+      _node.coro = coro;
+      _node.thread = spdk_get_thread();
+      Node* prev = _lock._tail.exchange(&_node, std::memory_order_acq_rel);
+      if (prev == nullptr)
+        return false;
+      prev->next.store(&_node, std::memory_order_release);
+
+      for (std::int32_t i = 0; i < _lock._spinCount; ++i) {
+        if (_node.state.load(std::memory_order_acquire) == GRANTED)
+          return false;
+        cpuRelax();
+      }
+      int expected = WAITING;
+      if (_node.state.compare_exchange_strong(expected, PARKED,
+                                              std::memory_order_acq_rel,
+                                              std::memory_order_acquire)) {
+        pmss::rcu::rcu_offline();
+        return true;
+      }
+      // 挂起之前刚好轮到自己
+      return false;
+    }
+
+    void await_resume() noexcept {
+      if (!_fast)
+        _lock.takeOver(&_node);
+    }
+
+   private:
+    QueuedSpinLock& _lock;
+    bool _fast;
+    Node _node;
+  };
+
+  // 拿到锁之后把n在队列里的位置转移到_holder上
+  void takeOver(Node* n) noexcept {
+    _holder.next.store(nullptr, std::memory_order_relaxed);
+    Node* expected = n;
+    if (_tail.compare_exchange_strong(expected, &_holder,
+                                      std::memory_order_acq_rel,
+                                      std::memory_order_relaxed))
+      return;
+    Node* next;
+    while ((next = n->next.load(std::memory_order_acquire)) == nullptr)
+      cpuRelax();
+    _holder.next.store(next, std::memory_order_relaxed);
+  }
+
   std::int32_t _spinCount;
-  std::atomic<bool> _locked;
+  std::atomic<Node*> _tail;
+  // 当前持有者占用的队列节点
+  Node _holder;
 };
 
+inline QueuedSpinLock::LockAwaiter QueuedSpinLock::coLock() noexcept {
+  return LockAwaiter(*this);
+}
+
 }  // namespace coro
 }  // namespace async_simple
 
@@ -0,0 +1,218 @@
+#ifndef ASYNC_SIMPLE_CORO_SPSCRING_H
+#define ASYNC_SIMPLE_CORO_SPSCRING_H
+
+#include <atomic>
+#include <cassert>
+#include <coroutine>
+#include <cstddef>
+#include <new>
+#include <optional>
+#include <utility>
+#include "rcu.hpp"
+#include "schedule.hpp"
+#include "spinlock.hpp"
+
+namespace async_simple {
+namespace coro {
+
+// 单生产者单消费者的环形队列，用于两个reactor之间的高频传递
+//
+// 生产者和消费者各自的下标放在不同的cache line上，并且各自缓存一份对方的
+// 下标，只有缓存的值不够用时才去读对方的cache line。
+// 生产者每emplace batch个元素才发布一次_tail，消费者每取batch个元素才发布
+// 一次_head，减少cache line在两个核之间来回传递，生产者可以用flush()立即发布。
+// 元素直接在环上原地构造，pop()时移出。
+//
+// co_await pop()在队列空时先自旋spinBudget次，仍然是空的才把消费者挂起。
+// 消费者挂起前先设置_parked再重新检查_tail，生产者发布_tail之后先fence
+// 再检查_parked，所以不会丢失唤醒。消费者在自己挂起时所在的线程上恢复。
+template <typename T>
+class SpscRing {
+ private:
+  class PopAwaiter;
+
+ public:
+  // capacity会向上取整到2的幂
+  explicit SpscRing(size_t capacity, size_t batch = 16,
+                    size_t spinBudget = 1024)
+      : _tail(0),
+        _tailLocal(0),
+        _tailPublished(0),
+        _headCache(0),
+        _head(0),
+        _headLocal(0),
+        _headPublished(0),
+        _tailCache(0),
+        _parked(false),
+        _closed(false),
+        _spinBudget(spinBudget) {
+    size_t n = 2;
+    while (n < capacity)
+      n <<= 1;
+    _mask = n - 1;
+    _batch = batch == 0 ? 1 : (batch > n ? n : batch);
+    _slots = new Slot[n];
+  }
+
+  SpscRing(const SpscRing&) = delete;
+  SpscRing& operator=(const SpscRing&) = delete;
+
+  ~SpscRing() {
+    for (size_t i = _headLocal; i != _tailLocal; ++i)
+      slot(i)->~T();
+    delete[] _slots;
+  }
+
+  // 生产者调用，队列满时返回false
+  template <typename... Args>
+  bool tryEmplace(Args&&... args) {
+    if (_tailLocal - _headCache > _mask) {
+      _headCache = _head.load(std::memory_order_acquire);
+      if (_tailLocal - _headCache > _mask) {
+        // 还没发布的元素要让消费者看到，否则双方都会一直等下去
+        flush();
+        return false;
+      }
+    }
+    new (&_slots[_tailLocal & _mask]) T(std::forward<Args>(args)...);
+    ++_tailLocal;
+    if (_tailLocal - _tailPublished >= _batch)
+      flush();
+    return true;
+  }
+
+  // 生产者调用，发布所有已经emplace的元素
+  void flush() {
+    if (_tailPublished == _tailLocal)
+      return;
+    _tailPublished = _tailLocal;
+    _tail.store(_tailLocal, std::memory_order_release);
+    wakeConsumer();
+  }
+
+  // 生产者调用，之后消费者取完剩下的元素就得到std::nullopt
+  void close() {
+    _tailPublished = _tailLocal;
+    _tail.store(_tailLocal, std::memory_order_release);
+    _closed.store(true, std::memory_order_release);
+    wakeConsumer();
+  }
+
+  // 消费者调用，队列空时返回std::nullopt
+  std::optional<T> tryPop() {
+    std::optional<T> item;
+    if (_headLocal == _tailCache) {
+      _tailCache = _tail.load(std::memory_order_acquire);
+      if (_headLocal == _tailCache) {
+        publishHead();
+        return item;
+      }
+    }
+    T* p = slot(_headLocal);
+    item.emplace(std::move(*p));
+    p->~T();
+    ++_headLocal;
+    if (_headLocal - _headPublished >= _batch)
+      publishHead();
+    return item;
+  }
+
+  // 消费者调用，co_await的结果为std::nullopt表示已经关闭并且取空了
+  [[nodiscard]] PopAwaiter pop() { return PopAwaiter(*this); }
+
+  size_t capacity() const { return _mask + 1; }
+
+ private:
+  struct alignas(T) Slot {
+    unsigned char storage[sizeof(T)];
+  };
+
+  class PopAwaiter {
+   public:
+    explicit PopAwaiter(SpscRing& ring) : _ring(ring) {}
+
+    bool await_ready() {
+      for (size_t i = 0;; ++i) {
+        _item = _ring.tryPop();
+        if (_item || _ring._closed.load(std::memory_order_acquire))
+          return true;
+        if (i >= _ring._spinBudget)
+          return false;
+        cpuRelax();
+      }
+    }
+
+    bool await_suspend(std::coroutine_handle<> h) {
+      _ring._h = h;
+      _ring._thread = spdk_get_thread();
+      _ring._parked.store(true, std::memory_order_seq_cst);
+      if (_ring._tail.load(std::memory_order_seq_cst) == _ring._headLocal &&
+          !_ring._closed.load(std::memory_order_seq_cst)) {
+        pmss::rcu::rcu_offline();
+        return true;
+      }
+      // 生产者已经拿走_parked的话它会来恢复我们，只能挂起
+      if (!_ring._parked.exchange(false, std::memory_order_acq_rel)) {
+        pmss::rcu::rcu_offline();
+        return true;
+      }
+      return false;
+    }
+
+    std::optional<T> await_resume() {
+      if (!_item)
+        _item = _ring.tryPop();
+      return std::move(_item);
+    }
+
+   private:
+    SpscRing& _ring;
+    std::optional<T> _item;
+  };
+
+  T* slot(size_t i) {
+    return std::launder(reinterpret_cast<T*>(&_slots[i & _mask]));
+  }
+
+  void publishHead() {
+    if (_headPublished == _headLocal)
+      return;
+    _headPublished = _headLocal;
+    _head.store(_headLocal, std::memory_order_release);
+  }
+
+  void wakeConsumer() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (_parked.load(std::memory_order_relaxed) &&
+        _parked.exchange(false, std::memory_order_acq_rel))
+      pmss::resume_on(_thread, _h);
+  }
+
+  // 生产者写，消费者读
+  alignas(64) std::atomic<size_t> _tail;
+  // 只有生产者访问
+  alignas(64) size_t _tailLocal;
+  size_t _tailPublished;
+  size_t _headCache;
+  // 消费者写，生产者读
+  alignas(64) std::atomic<size_t> _head;
+  // 只有消费者访问
+  alignas(64) size_t _headLocal;
+  size_t _headPublished;
+  size_t _tailCache;
+  // 消费者挂起时使用
+  alignas(64) std::atomic<bool> _parked;
+  std::atomic<bool> _closed;
+  std::coroutine_handle<> _h;
+  spdk_thread* _thread;
+  // 构造之后只读
+  alignas(64) Slot* _slots;
+  size_t _mask;
+  size_t _batch;
+  size_t _spinBudget;
+};
+
+}  // namespace coro
+}  // namespace async_simple
+
+#endif  // ASYNC_SIMPLE_CORO_SPSCRING_H
@@ -5,9 +5,13 @@
 #include <cassert>
 #include <concepts>
 #include <coroutine>
+#include <cstdint>
 #include <cstdio>
+#include <cstdlib>
+#include <exception>
 #include <optional>
 #include <utility>
+#include <vector>
 
 // Lazy Task
 
@@ -26,9 +30,52 @@
 // 以此类推，直到最外层的协程，这时整个协程运行结束
 // 然后可以通过get()获取返回值，如果还没有返回值，get()会返回std::nullopt，出现错误
 
+namespace pmss {
+
+// 任务的优先级。high是默认的，给延迟敏感的前台请求；low给compaction、scrub
+// 之类的后台任务：yield之后排在高优先级的协程后面，I/O也限制并发的数量。
+// 优先级存在promise的_priority里，没有设置的协程在被co_await的时候
+// 继承等待它的协程的优先级，所以只需要给最外层的task设置
+enum class priority : uint8_t { high = 0, low = 1 };
+inline constexpr int num_priorities = 2;
+inline constexpr uint8_t priority_unset = 0xff;
+
+// 协程的优先级，promise里没有_priority或者没有设置时是high
+template <class Promise>
+priority priority_of(std::coroutine_handle<Promise> h) noexcept {
+  if constexpr (requires { h.promise()._priority; }) {
+    uint8_t p = h.promise()._priority;
+    return p == priority_unset ? priority::high : static_cast<priority>(p);
+  } else {
+    return priority::high;
+  }
+}
+
+template <class Promise, class Caller>
+void inherit_priority(Promise& callee,
+                      std::coroutine_handle<Caller> caller) noexcept {
+  if (callee._priority == priority_unset)
+    callee._priority = static_cast<uint8_t>(priority_of(caller));
+}
+
+// co_await this_priority()得到当前协程的优先级，不会挂起
+struct this_priority {
+  bool await_ready() const noexcept { return false; }
+  template <class Promise>
+  bool await_suspend(std::coroutine_handle<Promise> h) noexcept {
+    _p = priority_of(h);
+    return false;
+  }
+  priority await_resume() const noexcept { return _p; }
+  priority _p = priority::high;
+};
+
+};  // namespace pmss
+
 // 每个协程都有一个caller，当协程结束的时候，final_suspend返回caller
 template <class T>
 struct task {
+  using value_type = T;
   struct promise_type {
     std::suspend_always initial_suspend() { return {}; }
     // 协程对象的返回值应该被使用
@@ -36,10 +83,17 @@ struct task {
     // 避免协程在子协程中设置了返回值，但是父协程返回的是默认值
     void return_value(T value) {
       assert(!_value.has_value());
-      _value = value;
+      _value.emplace(std::move(value));
     }
 
-    [[noreturn]] static void unhandled_exception() { throw; }
+#if __cpp_exceptions
+    // 异常先存在promise里，到co_await这个task的地方再重新抛出，
+    // 直接throw会从协程的恢复点一直抛到reactor，整个app都会退出
+    void unhandled_exception() { _exception = std::current_exception(); }
+    std::exception_ptr _exception = nullptr;
+#else
+    [[noreturn]] static void unhandled_exception() { std::abort(); }
+#endif
     // 在协程结束的时候，恢复caller
     struct resume_awaiter {
       bool await_ready() const noexcept { return false; }
@@ -54,6 +108,7 @@ struct task {
     // 禁止在其中使用co_await未知的类型
     /* void await_transform() = delete; */
     std::coroutine_handle<> _caller = std::noop_coroutine();
+    uint8_t _priority = pmss::priority_unset;
     // 因为协程可能没有返回值，所以用optional来区分没有值的情况
     std::optional<T> _value = std::nullopt;
   };
@@ -79,8 +134,10 @@ struct task {
     // 这里的callee是当前协程的handle，因为先构造了子协程的对象，然后
     // 调用callee::operator co_await()，然后因为在caller中调用了co_await
     // 所以这里的caller就是父协程的handle
-    auto await_suspend(std::coroutine_handle<> caller) noexcept {
+    template <class Promise>
+    auto await_suspend(std::coroutine_handle<Promise> caller) noexcept {
       _h.promise()._caller = caller;
+      pmss::inherit_priority(_h.promise(), caller);
       return _h;
       // 因为我们将initial_suspend的返回值设置成了suspend_never，所以我们不需要将控制权转移到callee中
       // 事实上调用这个函数的时候callee已经执行完了
@@ -88,6 +145,13 @@ struct task {
 
     // 这个是co_await的返回值，也就是子协程的返回值，可以保证await_resume的时候子协程已经结束了，所以返回值一定是有效的
     T await_resume() {
+#if __cpp_exceptions
+      if (_h.promise()._exception) {
+        auto e = _h.promise()._exception;
+        _h.destroy();
+        std::rethrow_exception(e);
+      }
+#endif
       auto r = std::move(_h.promise()._value.value());
       _h.destroy();
       return r;
@@ -96,6 +160,12 @@ struct task {
   };
 
   auto operator co_await() { return Awaiter{std::exchange(_h, nullptr)}; }
+  // 设置优先级，比如add_task(scrub().with_priority(pmss::priority::low))，
+  // 它co_await的子协程都继承这个优先级
+  task&& with_priority(pmss::priority p) && {
+    _h.promise()._priority = static_cast<uint8_t>(p);
+    return std::move(*this);
+  }
   // 还是不要定义这个函数了，因为协程很可能因为暂停了没有执行完，这样返回值是无效的
   T operator()() = delete;
   /* T operator()() { */
@@ -103,18 +173,29 @@ struct task {
   /*   return _h.promise()._value.value(); */
   /* } */
   std::optional<T> get() { return _h.promise()._value; }
+#if __cpp_exceptions
+  // 协程抛出了异常时get()为std::nullopt，异常从这里取
+  std::exception_ptr exception() { return _h.promise()._exception; }
+#endif
   void start() { _h.resume(); }
   bool done() { return _h.done(); }
 };
 
 template <>
 struct task<void> {
+  using value_type = void;
   struct promise_type {
     std::suspend_always initial_suspend() { return {}; }
     [[nodiscard]] task<void> get_return_object() { return task<void>(this); }
     void return_void() {}
 
-    [[noreturn]] static void unhandled_exception() { throw; }
+#if __cpp_exceptions
+    // 和task<T>一样，在co_await的地方重新抛出
+    void unhandled_exception() { _exception = std::current_exception(); }
+    std::exception_ptr _exception = nullptr;
+#else
+    [[noreturn]] static void unhandled_exception() { std::abort(); }
+#endif
     struct resume_awaiter {
       bool await_ready() const noexcept { return false; }
       auto await_suspend(std::coroutine_handle<promise_type> callee) noexcept {
@@ -128,6 +209,7 @@ struct task<void> {
     resume_awaiter final_suspend() noexcept { return resume_awaiter{}; }
     /* void await_transform() = delete; */
     std::coroutine_handle<> _caller = std::noop_coroutine();
+    uint8_t _priority = pmss::priority_unset;
   };
 
   using handle = std::coroutine_handle<promise_type>;
@@ -152,16 +234,31 @@ struct task<void> {
     // 这里的callee是当前协程的handle，因为先构造了子协程的对象，然后
     // 调用callee::operator co_await()，然后因为在caller中调用了co_await
     // 所以这里的caller就是父协程的handle
-    auto await_suspend(std::coroutine_handle<> caller) noexcept {
+    template <class Promise>
+    auto await_suspend(std::coroutine_handle<Promise> caller) noexcept {
       _h.promise()._caller = caller;
+      pmss::inherit_priority(_h.promise(), caller);
       return _h;
     }
 
     // 这个是co_await的返回值，也就是子协程的返回值，可以保证await_resume的时候子协程已经结束了，所以返回值一定是有效的
-    void await_resume() { _h.destroy(); }
+    void await_resume() {
+#if __cpp_exceptions
+      auto e = _h.promise()._exception;
+      _h.destroy();
+      if (e)
+        std::rethrow_exception(e);
+#else
+      _h.destroy();
+#endif
+    }
     handle _h;
   };
   auto operator co_await() { return Awaiter{std::exchange(_h, nullptr)}; }
+  task&& with_priority(pmss::priority p) && {
+    _h.promise()._priority = static_cast<uint8_t>(p);
+    return std::move(*this);
+  }
 
   // 还是不要定义这个函数了，因为协程很可能因为暂停了没有执行完，这样返回值是无效的
   void operator()() = delete;
@@ -169,4 +266,79 @@ struct task<void> {
   bool done() { return _h.done(); }
 };
 
+// 给锁一类的awaiter用：快速路径在await_ready里同步完成，
+// 需要等待时才把慢速路径创建成task<int>放进_slow，
+// 这样不需要等待的时候不会分配协程帧
+struct slow_path_awaiter {
+  template <class Promise>
+  auto await_suspend(std::coroutine_handle<Promise> caller) noexcept {
+    _slow->_h.promise()._caller = caller;
+    pmss::inherit_priority(_slow->_h.promise(), caller);
+    return _slow->_h;
+  }
+  void await_resume() noexcept { _slow.reset(); }
+
+  std::optional<task<int>> _slow;
+};
+
+// 调度器用来运行最外层task的包装协程：不需要返回值，也没有人co_await它，
+// 结束的时候协程帧自己销毁，不用放进任何全局容器里保存。
+// 创建之后必须调用start()，否则协程帧会泄漏
+struct detached_task {
+  struct promise_type {
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    // final_suspend不挂起，协程结束时帧直接销毁
+    std::suspend_never final_suspend() noexcept { return {}; }
+    detached_task get_return_object() {
+      return detached_task{handle::from_promise(*this)};
+    }
+    void return_void() noexcept {}
+    // 包装协程自己负责捕获被包装的task抛出的异常
+    [[noreturn]] static void unhandled_exception() noexcept { std::abort(); }
+    // 还没开始运行时用来把它挂到调度器的注入队列上，不需要另外分配节点
+    promise_type* _next = nullptr;
+    uint8_t _priority = pmss::priority_unset;
+  };
+
+  using handle = std::coroutine_handle<promise_type>;
+  handle _h;
+
+  // 定义在下面的trampoline_resume之后
+  void start();
+};
+
+namespace pmss {
+
+// 每个线程一个trampoline：在回调里恢复协程统一走trampoline_resume。
+// 嵌套的深度不超过trampoline_max_depth时直接恢复，和原来的行为一样，
+// 锁的handoff之类的唤醒不会被推迟；更深的（比如很长的unlock唤醒链，
+// 或者I/O一直同步完成）只把handle放进队列，等最外层的resume()返回之后
+// 再依次恢复。这样不管唤醒链有多长，栈上最多只有trampoline_max_depth层。
+// 队列在排空之后只clear不释放，稳定之后不再分配内存
+inline constexpr int trampoline_max_depth = 16;
+inline thread_local std::vector<std::coroutine_handle<>> trampoline_queue;
+inline thread_local int trampoline_depth = 0;
+
+inline void trampoline_resume(std::coroutine_handle<> h) {
+  if (trampoline_depth >= trampoline_max_depth) {
+    trampoline_queue.push_back(h);
+    return;
+  }
+  ++trampoline_depth;
+  h.resume();
+  if (trampoline_depth == 1) {
+    // 恢复的协程还可能继续往队列里加，所以每次都重新读size()
+    for (size_t i = 0; i < trampoline_queue.size(); ++i)
+      trampoline_queue[i].resume();
+    trampoline_queue.clear();
+  }
+  --trampoline_depth;
+}
+
+};  // namespace pmss
+
+inline void detached_task::start() {
+  pmss::trampoline_resume(std::exchange(_h, nullptr));
+}
+
 #endif  // TASK_H
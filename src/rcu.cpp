@@ -1,31 +1,97 @@
 #include "rcu.hpp"
 #include <algorithm>
 #include <atomic>
+#include <cassert>
+#include <vector>
 #include "schedule.hpp"
 #include "spdk/env.h"
 
 namespace pmss {
 namespace rcu {
 
-std::atomic<unsigned long> versions[256];
+// 每个spdk_thread的读者版本独占一个cache line，并分配在该核所在的NUMA节点上，
+// 避免读者发布版本号时和其它核产生false sharing
+struct rcu_reader {
+  alignas(64) std::atomic<unsigned long> version;
+  // 每1024次rcu_read_lock发布一次版本号。跟着spdk_thread走而不是每个
+  // pthread一个：同一个reactor上有多个spdk_thread（或者迁移过来的）时，
+  // 一个线程rcu_offline之后另一个线程的计数不会把它的发布跳过去。
+  // 每次rcu_read_lock都会写，单独一个cache line，不影响写者轮询version
+  alignas(64) int count;
+};
+
+// 按spdk_thread的编号索引，synchronize_rcu只扫描参与RCU的这些spdk_thread
+static std::vector<rcu_reader*> readers;
 std::atomic<unsigned long> sequencer = 0;
 const static unsigned long DONE = LONG_LONG_MAX;
-thread_local int rcu_count = 1023;
+
+// 每次重新分配读者状态都加一，thread_local的缓存看到变化之后重新查找
+static std::atomic<unsigned long> readers_generation = 0;
+static thread_local spdk_thread* cached_thread = nullptr;
+static thread_local unsigned long cached_generation = 0;
+static thread_local rcu_reader* cached_reader = nullptr;
 
 void rcu_init() {
-  std::fill(versions, versions + 256, LONG_LONG_MAX);
+  readers.clear();
+}
+
+void rcu_attach_cores() {
+  readers.assign(num_workers, nullptr);
+  for (int i = 0; i < num_workers; ++i) {
+    int socket = spdk_env_get_socket_id(workers[i].core);
+    rcu_reader* reader = (rcu_reader*)spdk_zmalloc(
+        sizeof(rcu_reader), alignof(rcu_reader), nullptr, socket,
+        SPDK_MALLOC_DMA);
+    if (reader == nullptr) {
+      // 该节点上没有内存（比如no_huge时只有一个节点）
+      reader = (rcu_reader*)spdk_zmalloc(sizeof(rcu_reader),
+                                         alignof(rcu_reader), nullptr,
+                                         SPDK_ENV_SOCKET_ID_ANY,
+                                         SPDK_MALLOC_DMA);
+    }
+    assert(reader != nullptr);
+    reader->version.store(DONE, std::memory_order_relaxed);
+    reader->count = 1023;
+    readers[i] = reader;
+  }
+  readers_generation.fetch_add(1, std::memory_order_release);
+}
+
+void rcu_detach_cores() {
+  for (rcu_reader* reader : readers)
+    spdk_free(reader);
+  readers.clear();
+  readers_generation.fetch_add(1, std::memory_order_release);
+}
+
+// 不在我们的spdk_thread上（比如服务已经退出）的读者不参与宽限期。
+// 结果缓存在thread_local里，只有这个reactor上换了一个spdk_thread运行，
+// 或者读者状态重新分配过，才重新查找编号
+static inline rcu_reader* local_reader() {
+  spdk_thread* thread = spdk_get_thread();
+  unsigned long generation =
+      readers_generation.load(std::memory_order_acquire);
+  if (thread != cached_thread || generation != cached_generation)
+      [[unlikely]] {
+    cached_thread = thread;
+    cached_generation = generation;
+    int i = worker_index();
+    cached_reader = (size_t)i < readers.size() ? readers[i] : nullptr;
+  }
+  return cached_reader;
 }
 
 void rcu_read_lock() {
-  ++rcu_count;
-  if (rcu_count == 1024) [[unlikely]] {
-    rcu_count = 0;
-    int current_core = spdk_env_get_current_core();
+  rcu_reader* reader = local_reader();
+  if (reader == nullptr)
+    return;
+  if (++reader->count == 1024) [[unlikely]] {
+    reader->count = 0;
     unsigned long global_version = sequencer.load(std::memory_order_acquire);
-    if (global_version ==
-        versions[current_core].load(std::memory_order_relaxed))
+    std::atomic<unsigned long>& version = reader->version;
+    if (global_version == version.load(std::memory_order_relaxed))
       return;
-    versions[current_core].store(global_version, std::memory_order_release);
+    version.store(global_version, std::memory_order_release);
     std::atomic_thread_fence(std::memory_order_seq_cst);
   }
 }
@@ -33,19 +99,42 @@ void rcu_read_lock() {
 void rcu_read_unlock() {}
 
 void rcu_offline() {
-  int current_core = spdk_env_get_current_core();
-  versions[current_core].store(DONE, std::memory_order_release);
-  rcu_count = 1023;
+  rcu_reader* reader = local_reader();
+  if (reader == nullptr)
+    return;
+  reader->version.store(DONE, std::memory_order_release);
+  reader->count = 1023;
 }
 
 task<void> synchronize_rcu() {
-  unsigned long writer_version =
-      sequencer.fetch_add(1, std::memory_order_acquire) + 1;
-  int current_core = spdk_env_get_current_core();
-  for (int i = 0; i < num_threads; ++i) {
-    if (i == current_core)
+  return cond_synchronize_rcu(start_poll_synchronize_rcu());
+}
+
+unsigned long get_state_synchronize_rcu() {
+  return sequencer.load(std::memory_order_acquire) + 1;
+}
+
+unsigned long start_poll_synchronize_rcu() {
+  return sequencer.fetch_add(1, std::memory_order_acquire) + 1;
+}
+
+bool poll_state_synchronize_rcu(unsigned long cookie) {
+  rcu_reader* self = local_reader();
+  for (rcu_reader* reader : readers) {
+    if (reader == self)
+      continue;
+    if (cookie > reader->version.load(std::memory_order_acquire))
+      return false;
+  }
+  return true;
+}
+
+task<void> cond_synchronize_rcu(unsigned long cookie) {
+  rcu_reader* self = local_reader();
+  for (rcu_reader* reader : readers) {
+    if (reader == self)
       continue;
-    while (writer_version > versions[i].load(std::memory_order_acquire)) {
+    while (cookie > reader->version.load(std::memory_order_acquire)) {
       co_await yield();
     }
   }
@@ -54,6 +143,7 @@ task<void> synchronize_rcu() {
 thread_local call_rcu_data rcu_data;
 unsigned long rcu_data_enqueue(struct call_rcu_data* data,
                                struct rcu_head* head) {
+  head->next = nullptr;
   if (data->tail == nullptr) {
     data->head = data->tail = head;
   } else {
@@ -90,13 +180,13 @@ void free_rcu(struct rcu_head* head) {
 
 void thread_call_rcu() {
   // free memory call by the thread
-  int current_core = spdk_env_get_current_core();
+  rcu_reader* self = local_reader();
   unsigned long min_version = UINT_MAX;
-  for (int i = 0; i < num_threads; ++i) {
-    if (i == current_core)
+  for (rcu_reader* reader : readers) {
+    if (reader == self)
       continue;
-    min_version =
-        std::min(min_version, versions[i].load(std::memory_order_acquire));
+    min_version = std::min(
+        min_version, reader->version.load(std::memory_order_acquire));
   }
 
   rcu_head* node = rcu_data.head;
@@ -106,6 +196,7 @@ void thread_call_rcu() {
     if (head->version > min_version)
       break;
     head->func(head);
+    --rcu_data.count;
     rcu_data.head = node;
     if (node == nullptr) {
       rcu_data.tail = nullptr;
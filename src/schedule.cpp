@@ -1,5 +1,15 @@
 #include "schedule.hpp"
+#include <algorithm>
+#include <atomic>
 #include <cstdint>
+#include <exception>
+#include <mutex>
+#include <spdk/log.h>
+#include <spdk/scheduler.h>
+#include <string>
+#include <thread>
+#include <sys/eventfd.h>
+#include <unistd.h>
 #include "rcu.hpp"
 
 namespace pmss {
@@ -7,113 +17,315 @@ namespace pmss {
 // for scheduler
 char device_name[64];
 char json_file[256];
-std::vector<task<int>> tasks;
-std::list<task<void>> wrapper_tasks;
+std::vector<detached_task> tasks;
 int num_threads;
-char cpumask[16] = "0x";
+std::vector<uint32_t> reactor_cores;
+int num_workers;
+std::string cpumask;
+service_options options;
 spdk_bdev_desc* desc;
 spdk_bdev* bdev;
 int alive_tasks;
 spdk_thread* main_thread = nullptr;
 
 // for per-thread
-spdk_thread* threads[256];
-spdk_io_channel* channels[256];
-spdk_bdev_io_wait_entry wait_entries[256];
+worker_state* workers = nullptr;
+std::vector<int> thread_worker;
+bool count_wakeups = false;
+uint64_t mode_switches = 0;
+
+// on_workers_resized注册的hook，可能在静态初始化时注册，所以用函数内的static
+static std::mutex resize_hooks_guard;
+static std::vector<void (*)(int)>& resize_hooks() {
+  static std::vector<void (*)(int)> hooks;
+  return hooks;
+}
+
+// for persistent service
+static bool persistent = false;
+static std::atomic<bool> service_ready = false;
+static std::thread service_thread;
+static std::atomic<unsigned> submit_next_worker = 0;
+
+// for adaptive interrupt mode，只在主线程上访问
+struct reactor_load {
+  uint64_t last_wakeups;
+  bool polling;
+  // spdk_reactor_set_interrupt_mode是异步的，完成之前不能再次切换
+  bool switching;
+};
+static std::vector<reactor_load> reactor_loads;
+static spdk_poller* adaptive_poller = nullptr;
 
 void execute() {
   spdk_app_opts opts;
   spdk_app_opts_init(&opts, sizeof(opts));
   opts.name = "spdk_service";
   opts.json_config_file = json_file;
-  opts.no_huge = true;
-  opts.mem_size = 1024;
-  spdk_cpuset mask;
-  spdk_cpuset_zero(&mask);
-  for (int i = 0; i < num_threads; ++i) {
-    spdk_cpuset_set_cpu(&mask, i, true);
-  }
-  strcpy(cpumask + 2, spdk_cpuset_fmt(&mask));
-  opts.reactor_mask = cpumask;
+  opts.no_huge = !options.hugepages;
+  opts.mem_size = options.mem_size;
+  if (options.hugedir)
+    opts.hugedir = options.hugedir;
+  if (options.main_core >= 0)
+    opts.main_core = options.main_core;
+  opts.interrupt_mode = options.interrupt_mode;
+  opts.reactor_mask = cpumask.c_str();
 
   // block until all done
   spdk_app_start(&opts, scheduler_init, nullptr);
-}
-
-void run(task<int>&& t) {
-  tasks.emplace_back(std::move(t));
-  execute();
-}
-
-void add_task(task<int>&& t) {
-  tasks.emplace_back(std::move(t));
+  // 这一轮的task都已经结束了，下一次run()不能再派发它们
+  tasks.clear();
 }
 
 void run() {
   execute();
 }
 
-template <typename Range>
-void run_all(Range& range) {
-  for (auto& element : range) {
-    tasks.emplace_back(std::move(element));
+static void unregister_inbound(worker_state& w) {
+  spdk_poller_unregister(&w.inbound_poller);
+  spdk_interrupt_unregister(&w.inbound_intr);
+  if (w.inbound_fd >= 0) {
+    close(w.inbound_fd);
+    w.inbound_fd = -1;
   }
-  execute();
 }
 
 void thread_exit(void* args) {
-  long core = (long)args;
-  spdk_put_io_channel(channels[core]);
-  spdk_thread_exit(threads[core]);
+  worker_state& r = workers[(long)args];
+  unregister_inbound(r);
+  spdk_put_io_channel(r.channel);
+  spdk_thread_exit(r.thread);
 }
 
 void service_exit() {
-  for (int i = 0; i < num_threads; ++i) {
-    if (i == 0) {
-      spdk_put_io_channel(channels[i]);
+  spdk_poller_unregister(&adaptive_poller);
+  for (int i = 0; i < num_workers; ++i) {
+    if (workers[i].thread == main_thread) {
+      spdk_put_io_channel(workers[i].channel);
     } else {
-      spdk_thread_send_msg(threads[i], thread_exit, (void*)(long)i);
+      spdk_thread_send_msg(workers[i].thread, thread_exit, (void*)(long)i);
     }
   }
   spdk_bdev_close(desc);
+  rcu::rcu_detach_cores();
   DEBUG_PRINTF("Stopping app\n");
   spdk_app_stop(0);
 }
 
 void task_done(void* args) {
-  if (--alive_tasks == 0) {
+  // 常驻模式下由stop_service()退出
+  if (--alive_tasks == 0 && !persistent) {
     service_exit();
   }
 }
 
-task<void> task_run(void* args) {
-  task<int>* t = (task<int>*)
-      args;  // NOTICE：我觉得这里不能固定模板类型，因为本就无法确定task的类型
-  co_await* t;
-  rcu::rcu_offline();
-  spdk_thread_send_msg(main_thread, task_done, nullptr);
+void inject(int worker, detached_task::handle h) {
+  assert(worker >= 0 && worker < num_workers);
+  auto* p = &h.promise();
+  auto& head = workers[worker].inbound;
+  auto* old = head.load(std::memory_order_relaxed);
+  do {
+    p->_next = old;
+  } while (!head.compare_exchange_weak(old, p, std::memory_order_release,
+                                       std::memory_order_relaxed));
+  // 队列原来不为空时已经有人唤醒过了，一批task只需要一次write
+  int fd = workers[worker].inbound_fd;
+  if (old == nullptr && fd >= 0) {
+    uint64_t one = 1;
+    [[maybe_unused]] ssize_t n = write(fd, &one, sizeof(one));
+  }
 }
 
-void service_thread_run(void* args) {
-  task<void> t = task_run(args);
-  t.start();
-  // 要保证t不能被析构
-  if (!t.done())
-    wrapper_tasks.push_back(std::move(t));
+void inject(detached_task::handle h) {
+  unsigned n = submit_next_worker.fetch_add(1, std::memory_order_relaxed);
+  inject(n % num_workers, h);
+}
+
+// 在目标reactor自己的线程上运行，取出的task直接在这里启动，不再转发
+static int inbound_poll(void* args) {
+  auto& head = workers[(long)args].inbound;
+  if (head.load(std::memory_order_relaxed) == nullptr)
+    return SPDK_POLLER_IDLE;
+  auto* p = head.exchange(nullptr, std::memory_order_acquire);
+  // 栈是后进先出的，先反转成提交的顺序
+  detached_task::promise_type* ordered = nullptr;
+  while (p) {
+    auto* next = p->_next;
+    p->_next = ordered;
+    ordered = p;
+    p = next;
+  }
+  count_wakeup();
+  while (ordered) {
+    auto* next = ordered->_next;
+    trampoline_resume(detached_task::handle::from_promise(*ordered));
+    ordered = next;
+  }
+  return SPDK_POLLER_BUSY;
+}
+
+// 中断模式下由eventfd触发，先清掉计数再取队列，
+// 之后再推进来的task会重新写eventfd
+static int inbound_intr(void* args) {
+  uint64_t n;
+  int fd = workers[(long)args].inbound_fd;
+  [[maybe_unused]] ssize_t r = read(fd, &n, sizeof(n));
+  return inbound_poll(args);
+}
+
+// 中断模式下不让SPDK轮询这个poller，只靠inbound_fd唤醒；
+// 切换到轮询模式之后poller照常运行，inbound_fd上积累的计数不影响正确性
+static void inbound_set_interrupt_mode(spdk_poller* poller, void* args,
+                                       bool interrupt_mode) {}
+
+static void register_inbound_poller(long worker) {
+  worker_state& w = workers[worker];
+  w.inbound_poller = spdk_poller_register(inbound_poll, (void*)worker, 0);
+  if (w.inbound_fd >= 0) {
+    spdk_poller_register_interrupt(w.inbound_poller,
+                                   inbound_set_interrupt_mode, nullptr);
+    // 注册之前已经写过的eventfd是水平触发的，不会丢
+    w.inbound_intr = spdk_interrupt_register(w.inbound_fd, inbound_intr,
+                                             (void*)worker, "inbound");
+  }
+}
+
+static void stop_service_msg(void* args) {
+  // stop_service()之前所有提交的task都应该已经完成了，
+  // 其他spdk_thread的poller在thread_exit里注销
+  unregister_inbound(local_worker());
+  service_exit();
+}
+
+static void mode_switched(void* args) {
+  reactor_loads[(long)args].switching = false;
+  ++mode_switches;
+}
+
+// 在主线程上定期运行：统计每个核上这段时间的唤醒次数，负载高的核切换到轮询模式，
+// 负载降下来之后再切换回中断模式。有迁移时按创建时所在的核统计，只是近似
+static int adaptive_poll(void* args) {
+  for (int k = 0; k < num_threads; ++k) {
+    uint64_t total = 0;
+    for (int w = k; w < num_workers; w += num_threads)
+      total += workers[w].wakeups.load(std::memory_order_relaxed);
+    reactor_load& load = reactor_loads[k];
+    uint64_t delta = total - load.last_wakeups;
+    load.last_wakeups = total;
+    if (load.switching)
+      continue;
+    bool polling;
+    if (!load.polling && delta >= options.poll_wakeups)
+      polling = true;
+    else if (load.polling && delta < options.poll_wakeups / 4)
+      polling = false;
+    else
+      continue;
+    load.switching = true;
+    if (spdk_reactor_set_interrupt_mode(reactor_cores[k], !polling,
+                                        mode_switched, (void*)(long)k) != 0) {
+      load.switching = false;
+      continue;
+    }
+    load.polling = polling;
+  }
+  return SPDK_POLLER_IDLE;
+}
+
+#if __cpp_exceptions
+void report_task_exception(std::exception_ptr ep) {
+  try {
+    std::rethrow_exception(ep);
+  } catch (const std::exception& e) {
+    SPDK_ERRLOG("task on core %u threw: %s\n", spdk_env_get_current_core(),
+                e.what());
+  } catch (...) {
+    SPDK_ERRLOG("task on core %u threw an unknown exception\n",
+                spdk_env_get_current_core());
+  }
+}
+#endif
+
+// 一条消息启动一个spdk_thread上的一批task，不用每个task发一次消息
+static std::vector<std::vector<detached_task::handle>> worker_batches;
+
+void service_thread_run_batch(void* args) {
+  auto* batch = (std::vector<detached_task::handle>*)args;
+  count_wakeup();
+  // 在trampoline里启动，task里同步完成的唤醒不会让栈越来越深；
+  // 包装协程结束时自己销毁，结束之前发task_done给主线程
+  for (auto h : *batch)
+    trampoline_resume(h);
 }
 
 void service_thread_run_yield(void* args) {
   std::coroutine_handle<> h = std::coroutine_handle<>::from_address(args);
-  h.resume();
+  count_wakeup();
+  trampoline_resume(h);
+}
+
+// 每一轮只恢复开始时已经就绪的协程，恢复之后又yield的排到下一轮，
+// 两轮之间这个spdk_thread上的其他消息（I/O完成、跨线程的唤醒）照常处理，
+// 和原来每次yield发一条消息一样不会一直占着reactor
+static void drain_ready(void* args) {
+  worker_state& w = *(worker_state*)args;
+  w.drain_scheduled = false;
+  count_wakeup();
+  auto& high = w.ready[(int)priority::high];
+  auto& low = w.ready[(int)priority::low];
+  size_t n_high = high.size();
+  size_t n_low = 0;
+  if (n_high == 0) {
+    n_low = low.size();
+    w.high_rounds = 0;
+  } else if (options.high_priority_weight > 0 &&
+             ++w.high_rounds >= options.high_priority_weight) {
+    n_low = std::min<size_t>(1, low.size());
+    w.high_rounds = 0;
+  }
+  // 先出队再恢复，恢复的协程可能又往队列里加
+  for (size_t i = 0; i < n_high; ++i) {
+    auto h = high.front();
+    high.pop_front();
+    trampoline_resume(h);
+  }
+  for (size_t i = 0; i < n_low; ++i) {
+    auto h = low.front();
+    low.pop_front();
+    trampoline_resume(h);
+  }
+  if (!w.drain_scheduled && (!high.empty() || !low.empty())) {
+    w.drain_scheduled = true;
+    spdk_thread_send_msg(w.thread, drain_ready, &w);
+  }
+}
+
+void make_ready(worker_state& w, priority p, std::coroutine_handle<> h) {
+  w.ready[(int)p].push_back(h);
+  if (!w.drain_scheduled) {
+    w.drain_scheduled = true;
+    spdk_thread_send_msg(w.thread, drain_ready, &w);
+  }
 }
 
 void myapp_bdev_event_cb(enum spdk_bdev_event_type type, struct spdk_bdev* bdev,
                          void* event_ctx) {}
 
 void thread_init_get_channel(void* args) {
-  long core = (long)args;
+  long worker = (long)args;
   // get_io_channel绑定了当前线程，所以需要发给对应的线程去创建
-  channels[core] = spdk_bdev_get_io_channel(desc);
+  workers[worker].channel = spdk_bdev_get_io_channel(desc);
+  if (persistent)
+    register_inbound_poller(worker);
+  if (options.threads_per_core > 1) {
+    // 先绑定在创建的核上，保证一开始每个核上的线程一样多，
+    // 之后放开到所有reactor的核上，让调度器可以迁移
+    spdk_cpuset all;
+    spdk_cpuset_zero(&all);
+    for (uint32_t core : reactor_cores)
+      spdk_cpuset_set_cpu(&all, core, true);
+    spdk_thread_set_cpumask(&all);
+  }
 }
 
 void scheduler_init(void* args) {
@@ -122,54 +334,158 @@ void scheduler_init(void* args) {
   assert(spdk_bdev_open_ext(device_name, true, myapp_bdev_event_cb, nullptr,
                             &desc) == 0);
   bdev = spdk_bdev_desc_get_bdev(desc);
+  rcu::rcu_attach_cores();
+  if (options.scheduler && spdk_scheduler_set(options.scheduler) != 0)
+    SPDK_ERRLOG("failed to set scheduler %s\n", options.scheduler);
 
   // 难道spdk_thread_create只会创建在当前reactor上吗，不应该吧
   // set cpu
   spdk_cpuset tmpmask;
-  spdk_thread* thread;
-  uint32_t i;
-  SPDK_ENV_FOREACH_CORE(i) {
-    DEBUG_PRINTF("creating schedule thread at core %d\n", i);
-    if (i != spdk_env_get_current_core()) {
+  uint64_t max_id = 0;
+  for (int k = 0; k < num_workers; ++k) {
+    uint32_t core = workers[k].core;
+    DEBUG_PRINTF("creating schedule thread at core %u\n", core);
+    // 主核上的第一个spdk_thread就是主线程
+    if (core == spdk_env_get_current_core() && k < num_threads) {
+      main_thread = spdk_get_thread();
+      workers[k].thread = main_thread;
+      workers[k].channel = spdk_bdev_get_io_channel(desc);
+    } else {
       // create schedule thread
       spdk_cpuset_zero(&tmpmask);
-      spdk_cpuset_set_cpu(&tmpmask, i, true);
-      thread = spdk_thread_create(NULL, &tmpmask);
-      spdk_thread_send_msg(thread, thread_init_get_channel, (void*)uint64_t(i));
-    } else {
-      thread = spdk_get_thread();
-      main_thread = thread;
-      channels[i] = spdk_bdev_get_io_channel(desc);
+      spdk_cpuset_set_cpu(&tmpmask, core, true);
+      workers[k].thread = spdk_thread_create(NULL, &tmpmask);
     }
-    threads[i] = thread;
+    max_id = std::max(max_id, spdk_thread_get_id(workers[k].thread));
+  }
+  // 中断模式下入站队列由eventfd唤醒，在外部线程能够提交之前创建好
+  if (persistent && spdk_interrupt_mode_is_enabled()) {
+    for (int k = 0; k < num_workers; ++k)
+      workers[k].inbound_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  }
+  if (spdk_interrupt_mode_is_enabled() && options.adaptive_period_us) {
+    reactor_loads.assign(num_threads, {});
+    count_wakeups = true;
+    adaptive_poller = spdk_poller_register(adaptive_poll, nullptr,
+                                           options.adaptive_period_us);
+  }
+  // 所有spdk_thread都创建好之后再建映射，之后的消息里才会查找
+  thread_worker.assign(max_id + 1, -1);
+  for (int k = 0; k < num_workers; ++k) {
+    thread_worker[spdk_thread_get_id(workers[k].thread)] = k;
+    if (workers[k].thread != main_thread)
+      spdk_thread_send_msg(workers[k].thread, thread_init_get_channel,
+                           (void*)(long)k);
   }
 
-  // round roubin
-  for (size_t i = 0; i < tasks.size(); ++i) {
-    int core = i % num_threads;
-    alive_tasks++;
-    spdk_thread_send_msg(threads[core], service_thread_run, &tasks[i]);
+  // 按编号round roubin，先按spdk_thread分好批，每个spdk_thread只发一条消息
+  worker_batches.assign(num_workers, {});
+  for (size_t i = 0; i < tasks.size(); ++i)
+    worker_batches[i % num_workers].push_back(tasks[i]._h);
+  alive_tasks += tasks.size();
+  for (int k = 0; k < num_workers; ++k) {
+    if (!worker_batches[k].empty())
+      spdk_thread_send_msg(workers[k].thread, service_thread_run_batch,
+                           &worker_batches[k]);
   }
 
-  if (tasks.size() == 0)
+  if (persistent) {
+    register_inbound_poller(worker_index());
+    service_ready.store(true, std::memory_order_release);
+  } else if (tasks.size() == 0) {
     service_exit();
+  }
 }
 
-void init_service(int thread_num, const char* config_file,
-                  const char* bdev_name) {
+void init_service(const service_options& opts) {
+  assert(opts.config_file && opts.bdev_name && !opts.cores.empty() &&
+         opts.threads_per_core >= 1);
   rcu::rcu_init();
-  num_threads = thread_num;
+  options = opts;
+  reactor_cores = opts.cores;
+  num_threads = reactor_cores.size();
+  // 用核列表的格式"[2,3,5]"，核再多也不会溢出，也不要求从0开始连续
+  std::string list;
+  for (uint32_t core : reactor_cores) {
+    if (!list.empty())
+      list.push_back(',');
+    list.append(std::to_string(core));
+  }
+  cpumask = '[' + list + ']';
+  num_workers = num_threads * opts.threads_per_core;
+  // 上一次的spdk_thread都已经退出了，按这次的数量重新分配
+  delete[] workers;
+  workers = new worker_state[num_workers]();
+  for (int k = 0; k < num_workers; ++k) {
+    workers[k].core = reactor_cores[k % num_threads];
+    workers[k].inbound_fd = -1;
+  }
+  thread_worker.clear();
+  count_wakeups = false;
+  mode_switches = 0;
+  // hook里可能再注册hook，复制一份再调用
+  std::vector<void (*)(int)> hooks;
+  {
+    std::lock_guard<std::mutex> guard(resize_hooks_guard);
+    hooks = resize_hooks();
+  }
+  for (auto hook : hooks)
+    hook(num_workers);
   alive_tasks = 0;
-  strncpy(device_name, bdev_name, sizeof(device_name) - 1);
+  strncpy(device_name, opts.bdev_name, sizeof(device_name) - 1);
   device_name[sizeof(device_name) - 1] = '\0';
-  strncpy(json_file, config_file, sizeof(json_file) - 1);
+  strncpy(json_file, opts.config_file, sizeof(json_file) - 1);
   json_file[sizeof(json_file) - 1] = '\0';
 }
 
+void on_workers_resized(void (*hook)(int workers)) {
+  std::lock_guard<std::mutex> guard(resize_hooks_guard);
+  auto& hooks = resize_hooks();
+  if (std::find(hooks.begin(), hooks.end(), hook) == hooks.end())
+    hooks.push_back(hook);
+}
+
+void init_service(int thread_num, const char* config_file,
+                  const char* bdev_name) {
+  init_service(default_options(thread_num, config_file, bdev_name));
+}
+
+service_options default_options(int thread_num, const char* config_file,
+                                const char* bdev_name) {
+  service_options opts;
+  opts.config_file = config_file;
+  opts.bdev_name = bdev_name;
+  for (int i = 0; i < thread_num; ++i)
+    opts.cores.push_back(i);
+  return opts;
+}
+
 void deinit_service() {
   spdk_app_fini();
 }
 
+void start_service(int thread_num, const char* config_file,
+                   const char* bdev_name) {
+  start_service(default_options(thread_num, config_file, bdev_name));
+}
+
+void start_service(const service_options& opts) {
+  init_service(opts);
+  persistent = true;
+  service_ready.store(false, std::memory_order_relaxed);
+  // spdk_app_start会一直阻塞到stop_service()，放到后台线程里
+  service_thread = std::thread(execute);
+  while (!service_ready.load(std::memory_order_acquire))
+    std::this_thread::yield();
+}
+
+void stop_service() {
+  spdk_thread_send_msg(main_thread, stop_service_msg, nullptr);
+  service_thread.join();
+  persistent = false;
+  deinit_service();
+}
+
 // 本来不应该有这种用法的，不过既然有直接在当前的reactor上运行是不是也可以，
 // 这种不能产生运行结果，所以不进入tasks中
 void launch_task_on_fire(task<void>&& t) {
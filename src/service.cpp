@@ -13,96 +13,285 @@
 
 namespace pmss {
 
-retry_context retry_contexts[256];
+// 记下结果，有协程在等就恢复它。start_read()/start_write()的请求可能在
+// co_await之前就完成了，这时没有协程可以恢复
+static void complete_io(result* res, int rc) {
+  res->res = rc;
+  res->done = true;
+  if (res->coro)
+    trampoline_resume(res->coro);
+}
+
 void spdk_io_complete_cb(struct spdk_bdev_io* bdev_io, bool success,
                          void* cb_arg) {
   spdk_bdev_free_io(bdev_io);
   // resume coroutine
-  result* res = (result*)cb_arg;
-  res->res = success ? 0 : 1;
-  res->coro.resume();
+  count_wakeup();
+  complete_io((result*)cb_arg, success ? 0 : 1);
 }
 
 void spdk_retry_read(void* args) {
-  int current_core = spdk_env_get_current_core();
   struct retry_context* ctx = (struct retry_context*)args;
-  int rc = spdk_bdev_read(desc, channels[current_core], ctx->buf, ctx->offset,
+  int rc = spdk_bdev_read(desc, local_worker().channel, ctx->buf, ctx->offset,
                           ctx->len, spdk_io_complete_cb, ctx->res);
   if (rc == -ENOMEM) {
     // retry again
     /* spdk_bdev_queue_io_wait(ctx->bdev, ctx->ch, */
     /*                         &rds[current_core].bdev_io_wait); */
   } else if (rc) {
-    ctx->res->res = rc;
-    ctx->res->coro.resume();
+    complete_io(ctx->res, rc);
   }
 }
 
 void spdk_retry_write(void* args) {
-  int current_core = spdk_env_get_current_core();
   struct retry_context* ctx = (struct retry_context*)args;
-  int rc = spdk_bdev_write(desc, channels[current_core], ctx->buf, ctx->offset,
-                           ctx->len, spdk_io_complete_cb, ctx->res);
+  int rc = spdk_bdev_write(desc, local_worker().channel, ctx->buf,
+                           ctx->offset, ctx->len, spdk_io_complete_cb,
+                           ctx->res);
   if (rc == -ENOMEM) {
     // retry again
     /* spdk_bdev_queue_io_wait(ctx->bdev, ctx->ch, */
     /*                         &rds[current_core].bdev_io_wait); */
   } else if (rc) {
-    ctx->res->res = rc;
-    ctx->res->coro.resume();
+    complete_io(ctx->res, rc);
   }
 }
 
-// buf must be dma buffer
-service_awaiter read(void* buf, int len, size_t offset) {
-  int current_core = spdk_env_get_current_core();
-  service_awaiter awaiter{};
-  int rc = spdk_bdev_read(desc, channels[current_core], buf, offset, len,
-                          spdk_io_complete_cb, &awaiter.res);
+// 把请求交给bdev，ENOMEM时用awaiter自己的wait_entry排队重试，
+// 几个协程同时重试也不会互相覆盖。返回false表示同步失败
+static bool start_io(worker_state& w, service_awaiter* a) {
+  retry_context& ctx = a->retry;
+  int rc = a->is_write
+               ? spdk_bdev_write(desc, w.channel, ctx.buf, ctx.offset, ctx.len,
+                                 spdk_io_complete_cb, &a->res)
+               : spdk_bdev_read(desc, w.channel, ctx.buf, ctx.offset, ctx.len,
+                                spdk_io_complete_cb, &a->res);
   if (rc == -ENOMEM) {
     // retry queue io
-    wait_entries[current_core].bdev = bdev;
-    wait_entries[current_core].cb_fn = spdk_retry_read;
-    wait_entries[current_core].cb_arg = &retry_contexts[current_core];
-
-    // set param to call back
-    retry_contexts[current_core].buf = buf;
-    retry_contexts[current_core].len = len;
-    retry_contexts[current_core].offset = offset;
-    retry_contexts[current_core].res = &awaiter.res;
-    spdk_bdev_queue_io_wait(bdev, channels[current_core],
-                            &wait_entries[current_core]);
+    a->wait_entry.bdev = bdev;
+    a->wait_entry.cb_fn = a->is_write ? spdk_retry_write : spdk_retry_read;
+    a->wait_entry.cb_arg = &ctx;
+    spdk_bdev_queue_io_wait(bdev, w.channel, &a->wait_entry);
   } else if (rc) {
-    awaiter.set_failure(rc);
+    a->res.res = rc;
+    a->res.done = true;
+    return false;
+  }
+  return true;
+}
+
+static int background_limit() {
+  return std::max(1, options.background_io_depth);
+}
+
+bool acquire_background_io(background_waiter* bw) {
+  worker_state& w = local_worker();
+  if (w.background_inflight < background_limit()) {
+    ++w.background_inflight;
+    return true;
+  }
+  bw->_next = nullptr;
+  if (w.background_tail)
+    w.background_tail->_next = bw;
+  else
+    w.background_head = bw;
+  w.background_tail = bw;
+  return false;
+}
+
+void background_io_done() {
+  worker_state& w = local_worker();
+  --w.background_inflight;
+  while (w.background_head &&
+         w.background_inflight < background_limit()) {
+    background_waiter* bw = w.background_head;
+    w.background_head = bw->_next;
+    if (!w.background_head)
+      w.background_tail = nullptr;
+    ++w.background_inflight;
+    bw->_admit(bw);
   }
+}
+
+// 排队的读写拿到名额之后提交，同步失败的直接恢复，
+// 它的await_resume会再调用background_io_done
+static void admit_service_io(background_waiter* bw) {
+  auto* a = static_cast<service_awaiter*>(bw);
+  if (!start_io(local_worker(), a))
+    trampoline_resume(a->res.coro);
+}
 
-  return awaiter;
+bool submit_io(service_awaiter* a) {
+  if (a->background) {
+    a->_admit = admit_service_io;
+    // 排在后面，由前面的后台I/O完成之后提交
+    if (!acquire_background_io(a))
+      return true;
+  }
+  return start_io(local_worker(), a);
+}
+
+// buf must be dma buffer
+service_awaiter read(void* buf, int len, size_t offset) {
+  return service_awaiter(buf, len, offset, false);
 }
 
 // read/write根据channel所在的线程，会将io请求发送到对应的spdk线程上
 // 可以根据这个进行一些调度
 service_awaiter write(void* buf, int len, size_t offset) {
-  int current_core = spdk_env_get_current_core();
-  service_awaiter awaiter{};
-  int rc = spdk_bdev_write(desc, channels[current_core], buf, offset, len,
-                           spdk_io_complete_cb, &awaiter.res);
-  if (rc == -ENOMEM) {
-    // retry queue io
-    wait_entries[current_core].bdev = bdev;
-    wait_entries[current_core].cb_fn = spdk_retry_write;
-    wait_entries[current_core].cb_arg = &retry_contexts[current_core];
-
-    // set param to call back
-    retry_contexts[current_core].buf = buf;
-    retry_contexts[current_core].len = len;
-    retry_contexts[current_core].offset = offset;
-    retry_contexts[current_core].res = &awaiter.res;
-    spdk_bdev_queue_io_wait(bdev, channels[current_core],
-                            &wait_entries[current_core]);
-  } else if (rc) {
-    awaiter.set_failure(rc);
+  return service_awaiter(buf, len, offset, true);
+}
+
+service_awaiter start_read(void* buf, int len, size_t offset) {
+  return service_awaiter(buf, len, offset, false, true);
+}
+
+service_awaiter start_write(void* buf, int len, size_t offset) {
+  return service_awaiter(buf, len, offset, true, true);
+}
+
+// scan的每个读请求一个slot，读完之后由消费者所在的线程上的回调恢复生成器
+struct scan_state;
+struct scan_slot {
+  void* buf;
+  size_t offset;
+  int len;
+  bool done;
+  int res;
+  std::coroutine_handle<> waiter;
+  scan_state* state;
+};
+
+// 放在堆上：消费者提前丢弃生成器时可能还有读请求没有完成，
+// 这时由最后一个完成的回调释放
+struct scan_state {
+  scan_state(int depth, int block_size) : slots(depth) {
+    for (auto& s : slots) {
+      s.buf = spdk_dma_zmalloc(block_size, 4096, nullptr);
+      s.state = this;
+    }
+  }
+  ~scan_state() {
+    for (auto& s : slots)
+      spdk_dma_free(s.buf);
+  }
+  std::vector<scan_slot> slots;
+  int inflight = 0;
+  bool abandoned = false;
+  // 低优先级的scan每个读请求占一个后台I/O名额，完成时释放
+  bool background = false;
+};
+
+struct scan_state_guard {
+  ~scan_state_guard() {
+    if (state->inflight == 0)
+      delete state;
+    else
+      state->abandoned = true;
   }
+  scan_state* state;
+};
 
-  return awaiter;
+struct scan_slot_awaiter {
+  bool await_ready() { return slot->done; }
+  void await_suspend(std::coroutine_handle<> coro) { slot->waiter = coro; }
+  void await_resume() {}
+  scan_slot* slot;
+};
+
+static void scan_complete_cb(struct spdk_bdev_io* bdev_io, bool success,
+                             void* cb_arg) {
+  spdk_bdev_free_io(bdev_io);
+  scan_slot* slot = (scan_slot*)cb_arg;
+  scan_state* state = slot->state;
+  // 恢复消费者之后state可能已经释放了，先记下来
+  bool background = state->background;
+  --state->inflight;
+  if (state->abandoned) {
+    if (state->inflight == 0)
+      delete state;
+  } else {
+    slot->res = success ? 0 : -EIO;
+    slot->done = true;
+    if (slot->waiter)
+      trampoline_resume(std::exchange(slot->waiter, nullptr));
+  }
+  if (background)
+    background_io_done();
+}
+
+// 低优先级的scan提交读请求之前等一个后台I/O名额
+struct background_io_awaiter : background_waiter {
+  bool await_ready() { return false; }
+  bool await_suspend(std::coroutine_handle<> h) {
+    _h = h;
+    _admit = admit;
+    return !acquire_background_io(this);
+  }
+  void await_resume() {}
+  static void admit(background_waiter* bw) {
+    trampoline_resume(static_cast<background_io_awaiter*>(bw)->_h);
+  }
+  std::coroutine_handle<> _h;
+};
+
+async_generator<scan_block> scan(size_t offset, size_t len, int block_size,
+                                 int depth) {
+  assert(block_size > 0 && depth > 0);
+  // 后台的扫描和其他低优先级I/O共用每个spdk_thread的名额，
+  // 窗口再大也用不上，不超过background_io_depth
+  bool background = co_await this_priority() == priority::low;
+  if (background)
+    depth = std::min(depth, background_limit());
+  uint32_t dev_block = spdk_bdev_get_block_size(bdev);
+  if (offset % dev_block || block_size % dev_block) {
+    co_yield scan_block{offset, nullptr, 0, -EINVAL};
+    co_return;
+  }
+  scan_state* state = new scan_state(depth, block_size);
+  state->background = background;
+  scan_state_guard guard{state};
+  size_t end = offset + len;
+  size_t next = offset;
+  // [head, tail)是已经提交的slot，按提交的顺序交给消费者
+  size_t head = 0, tail = 0;
+  while (true) {
+    // 把窗口补满，上一块的缓冲区在消费者再次调用next()之后才复用
+    while (tail - head < (size_t)depth && next < end) {
+      scan_slot& slot = state->slots[tail % depth];
+      slot.offset = next;
+      slot.len = (int)std::min((size_t)block_size, end - next);
+      slot.done = false;
+      // 不满一个设备块的尾部按整块读，block_size是设备块的整数倍，缓冲区放得下
+      int io_len = (slot.len + dev_block - 1) / dev_block * dev_block;
+      if (background)
+        co_await background_io_awaiter{};
+      int rc;
+      while (true) {
+        rc = spdk_bdev_read(desc, local_worker().channel, slot.buf,
+                            slot.offset, io_len, scan_complete_cb, &slot);
+        if (rc != -ENOMEM)
+          break;
+        // 等已经提交的请求完成一些再重试
+        co_await yield();
+      }
+      if (rc) {
+        slot.res = rc;
+        slot.done = true;
+        if (background)
+          background_io_done();
+      } else {
+        ++state->inflight;
+      }
+      next += slot.len;
+      ++tail;
+    }
+    if (head == tail)
+      break;
+    scan_slot& slot = state->slots[head % depth];
+    co_await scan_slot_awaiter{&slot};
+    co_yield scan_block{slot.offset, slot.buf, slot.len, slot.res};
+    ++head;
+  }
 }
 };  // namespace pmss
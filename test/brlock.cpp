@@ -0,0 +1,53 @@
+#include "brlock.hpp"
+#include "task.hpp"
+#include <gtest/gtest.h>
+#include "common.hpp"
+
+const int n_reactor = 4;
+const int n_reader = 8;
+const int n_writer = 2;
+const int n_round = 20000;
+
+async_simple::coro::BrLock brlock;
+// 写者持锁期间a和b不相等
+long a = 0, b = 0;
+std::atomic<int> active_readers = 0;
+
+task<int> reader(int idx) {
+  for (int i = 0; i < n_round; ++i) {
+    co_await brlock.coLockShared();
+    active_readers.fetch_add(1);
+    EXPECT_TRUE(a == b);
+    if (i % 128 == idx)
+      co_await yield();
+    EXPECT_TRUE(a == b);
+    active_readers.fetch_sub(1);
+    brlock.unlockShared();
+  }
+  co_return 0;
+}
+
+task<int> writer(int idx) {
+  for (int i = 0; i < n_round / 40; ++i) {
+    co_await brlock.coLock();
+    EXPECT_TRUE(active_readers.load() == 0);
+    ++a;
+    co_await yield();
+    ++b;
+    brlock.unlock();
+  }
+  co_return 0;
+}
+
+TEST(brlock, readers_writers) {
+  pmss::init_service(n_reactor, json_file, bdev_dev);
+  for (int i = 0; i < n_reader; ++i)
+    pmss::add_task(reader(i));
+  for (int i = 0; i < n_writer; ++i)
+    pmss::add_task(writer(i));
+  pmss::run();
+  pmss::deinit_service();
+
+  EXPECT_TRUE(a == n_writer * (n_round / 40));
+  EXPECT_TRUE(a == b);
+}
@@ -0,0 +1,91 @@
+#include "channel.hpp"
+#include "task.hpp"
+#include <gtest/gtest.h>
+#include <memory>
+#include "common.hpp"
+
+const int n_reactor = 4;
+const int n_producer = 8;
+const int n_consumer = 8;
+const int n_item = 4000;
+
+// 容量很小，发送者和接收者都会频繁挂起
+async_simple::coro::Channel<int> ch(4);
+std::atomic<int> producers_left = n_producer;
+std::atomic<int> seen[n_producer * n_item];
+std::atomic<long> n_received = 0;
+std::atomic<long> n_batches = 0;
+
+task<int> producer(int idx) {
+  for (int i = 0; i < n_item; ++i) {
+    bool ok = co_await ch.send(idx * n_item + i);
+    EXPECT_TRUE(ok);
+    if (i % 64 == idx)
+      co_await yield();
+  }
+  if (producers_left.fetch_sub(1) == 1)
+    ch.close();
+  co_return 0;
+}
+
+task<int> consumer(int idx) {
+  int buf[16];
+  while (true) {
+    // 一半的接收者逐个取，另一半批量取
+    if (idx % 2 == 0) {
+      auto v = co_await ch.recv();
+      if (!v)
+        break;
+      seen[*v].fetch_add(1);
+      n_received.fetch_add(1);
+    } else {
+      size_t n = co_await ch.recv_many(buf, 16);
+      if (n == 0)
+        break;
+      EXPECT_TRUE(n <= 16);
+      for (size_t i = 0; i < n; ++i)
+        seen[buf[i]].fetch_add(1);
+      n_received.fetch_add(n);
+      n_batches.fetch_add(1);
+    }
+  }
+  co_return 0;
+}
+
+// 只能移动的元素，关闭之后剩下的元素仍然能取出来，取空之后得到std::nullopt
+async_simple::coro::Channel<std::unique_ptr<int>> uch(2);
+
+task<int> close_drain() {
+  EXPECT_TRUE(co_await uch.send(std::make_unique<int>(1)));
+  EXPECT_TRUE(uch.trySend(std::make_unique<int>(2)));
+  EXPECT_FALSE(uch.trySend(std::make_unique<int>(3)));
+  uch.close();
+  EXPECT_FALSE(co_await uch.send(std::make_unique<int>(4)));
+  auto a = co_await uch.recv();
+  EXPECT_TRUE(a && **a == 1);
+  auto b = uch.tryRecv();
+  EXPECT_TRUE(b && **b == 2);
+  auto c = co_await uch.recv();
+  EXPECT_FALSE(c.has_value());
+  co_return 0;
+}
+
+TEST(channel, mpmc) {
+  pmss::init_service(n_reactor, json_file, bdev_dev);
+  for (int i = 0; i < n_consumer; ++i)
+    pmss::add_task(consumer(i));
+  for (int i = 0; i < n_producer; ++i)
+    pmss::add_task(producer(i));
+  pmss::add_task(close_drain());
+  pmss::run();
+  pmss::deinit_service();
+
+  // 每个元素恰好被取到一次
+  EXPECT_TRUE(n_received.load() == n_producer * n_item);
+  for (int i = 0; i < n_producer * n_item; ++i)
+    EXPECT_TRUE(seen[i].load() == 1);
+  EXPECT_TRUE(ch.closed());
+  EXPECT_FALSE(ch.trySend(0));
+  EXPECT_FALSE(ch.tryRecv().has_value());
+}
+
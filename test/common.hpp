@@ -1,6 +1,25 @@
+#include <sched.h>
+#include <cstdint>
+#include <vector>
+
 #ifndef PMSS_TEST_BDEV_JSON
 #define PMSS_TEST_BDEV_JSON "bdev.json"
 #endif
 
 static inline const char* json_file = PMSS_TEST_BDEV_JSON;
 static inline const char* bdev_dev = "Malloc0";
+
+// 这个进程可以使用的核，需要真的在某些核上启动reactor的测试从这里面选，
+// 不够的时候跳过
+static inline std::vector<uint32_t> host_cores() {
+  std::vector<uint32_t> cores;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (sched_getaffinity(0, sizeof(set), &set) != 0)
+    return cores;
+  for (uint32_t i = 0; i < CPU_SETSIZE; ++i) {
+    if (CPU_ISSET(i, &set))
+      cores.push_back(i);
+  }
+  return cores;
+}
@@ -0,0 +1,99 @@
+#include "expected.hpp"
+#include "generator.hpp"
+#include "schedule.hpp"
+#include "task.hpp"
+#include <cerrno>
+#include <cstring>
+#include <gtest/gtest.h>
+#include <stdexcept>
+#include "common.hpp"
+
+const int n_reactor = 2;
+
+task<int> throws_after_yield(int v) {
+  co_await yield();
+  if (v > 0)
+    throw std::runtime_error("bad request");
+  co_return v;
+}
+
+task<void> throws_void() {
+  co_await yield();
+  throw std::logic_error("void");
+}
+
+async_generator<int> throws_midway() {
+  co_yield 1;
+  throw std::out_of_range("midway");
+}
+
+pmss::expected_task<int> checked(int v) {
+  co_await yield();
+  if (v < 0)
+    co_return pmss::unexpected(-EINVAL);
+  co_return v * 2;
+}
+
+std::atomic<int> caught = 0;
+std::atomic<int> survivors = 0;
+
+// 异常在co_await子task的地方抛出，可以正常捕获
+task<int> catcher() {
+  try {
+    co_await throws_after_yield(1);
+    EXPECT_TRUE(false);
+  } catch (const std::runtime_error& e) {
+    EXPECT_TRUE(strcmp(e.what(), "bad request") == 0);
+    caught.fetch_add(1);
+  }
+  EXPECT_TRUE(co_await throws_after_yield(0) == 0);
+
+  try {
+    co_await throws_void();
+    EXPECT_TRUE(false);
+  } catch (const std::logic_error&) {
+    caught.fetch_add(1);
+  }
+
+  auto gen = throws_midway();
+  EXPECT_TRUE(*co_await gen.next() == 1);
+  try {
+    co_await gen.next();
+    EXPECT_TRUE(false);
+  } catch (const std::out_of_range&) {
+    caught.fetch_add(1);
+  }
+
+  auto ok = co_await checked(21);
+  EXPECT_TRUE(ok && *ok == 42);
+  auto bad = co_await checked(-1);
+  EXPECT_FALSE(bad.has_value());
+  EXPECT_TRUE(bad.error() == -EINVAL);
+  EXPECT_TRUE(bad.value_or(7) == 7);
+  co_return 0;
+}
+
+// 没有人捕获的异常只结束这一个task，其他reactor上的task照常运行
+task<int> uncaught() {
+  co_await throws_after_yield(1);
+  co_return 0;
+}
+
+task<int> survivor() {
+  for (int i = 0; i < 100; ++i)
+    co_await yield();
+  survivors.fetch_add(1);
+  co_return 0;
+}
+
+TEST(exception, propagate_to_awaiter) {
+  pmss::init_service(n_reactor, json_file, bdev_dev);
+  pmss::add_task(catcher());
+  pmss::add_task(uncaught());
+  pmss::add_task(survivor());
+  pmss::add_task(survivor());
+  pmss::run();
+  pmss::deinit_service();
+  EXPECT_TRUE(caught.load() == 3);
+  EXPECT_TRUE(survivors.load() == 2);
+}
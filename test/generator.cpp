@@ -0,0 +1,99 @@
+#include "generator.hpp"
+#include "service.hpp"
+#include "spdk/env.h"
+#include "task.hpp"
+#include <cstring>
+#include <gtest/gtest.h>
+#include "common.hpp"
+
+const int block_size = 4096;
+const int n_block = 64;
+
+// 生成器内部可以co_await
+async_generator<int> counter(int n) {
+  for (int i = 0; i < n; ++i) {
+    if (i % 3 == 0)
+      co_await yield();
+    co_yield i;
+  }
+}
+
+task<int> generator_basic() {
+  auto gen = counter(10);
+  int expect = 0;
+  while (auto v = co_await gen.next()) {
+    EXPECT_TRUE(*v == expect);
+    ++expect;
+  }
+  EXPECT_TRUE(expect == 10);
+  EXPECT_TRUE(gen.done());
+  EXPECT_FALSE((co_await gen.next()).has_value());
+  co_return 0;
+}
+
+task<int> scan_blocks() {
+  char* buf = (char*)spdk_dma_zmalloc(block_size, 4096, nullptr);
+  for (int i = 0; i < n_block; ++i) {
+    memset(buf, 'a' + i % 26, block_size);
+    int rc = co_await pmss::write(buf, block_size, (size_t)i * block_size);
+    EXPECT_TRUE(rc == 0);
+  }
+  spdk_dma_free(buf);
+
+  // 最后一块不满block_size，但是按设备的块对齐
+  size_t len = (size_t)n_block * block_size - 512;
+  auto gen = pmss::scan(0, len, block_size, 4);
+  int i = 0;
+  size_t total = 0;
+  while (auto b = co_await gen.next()) {
+    EXPECT_TRUE(b->res == 0);
+    EXPECT_TRUE(b->offset == (size_t)i * block_size);
+    const char* p = (const char*)b->buf;
+    EXPECT_TRUE(p[0] == 'a' + i % 26 && p[b->len - 1] == 'a' + i % 26);
+    total += b->len;
+    ++i;
+  }
+  EXPECT_TRUE(i == n_block);
+  EXPECT_TRUE(total == len);
+
+  // 尾部不按设备的块对齐：按整块读出来，len仍然是范围内的长度
+  {
+    auto tail = pmss::scan((size_t)(n_block - 1) * block_size, block_size - 100,
+                           block_size, 2);
+    auto b = co_await tail.next();
+    EXPECT_TRUE(b && b->res == 0 && b->len == block_size - 100);
+    const char* p = (const char*)b->buf;
+    EXPECT_TRUE(p[b->len - 1] == 'a' + (n_block - 1) % 26);
+    EXPECT_FALSE((co_await tail.next()).has_value());
+  }
+
+  // 起始位置不对齐的只产生一块-EINVAL
+  {
+    auto bad = pmss::scan(100, len, block_size, 4);
+    auto b = co_await bad.next();
+    EXPECT_TRUE(b && b->res == -EINVAL && b->buf == nullptr);
+    EXPECT_FALSE((co_await bad.next()).has_value());
+  }
+
+  // 提前丢弃生成器，还在飞的读请求完成之后再释放
+  {
+    auto early = pmss::scan(0, len, block_size, 8);
+    auto b = co_await early.next();
+    EXPECT_TRUE(b && b->offset == 0);
+  }
+  for (int j = 0; j < 16; ++j)
+    co_await yield();
+  co_return 0;
+}
+
+task<int> all() {
+  co_await generator_basic();
+  co_await scan_blocks();
+  co_return 0;
+}
+
+TEST(generator, stream_scan) {
+  pmss::init_service(1, json_file, bdev_dev);
+  pmss::run(all());
+  pmss::deinit_service();
+}
@@ -0,0 +1,78 @@
+#include <chrono>
+#include <cstring>
+#include <thread>
+#include "schedule.hpp"
+#include "service.hpp"
+#include "task.hpp"
+#include <gtest/gtest.h>
+#include "common.hpp"
+
+const int n_reactor = 2;
+const int n_burst = 8;
+const int n_yield = 20000;
+
+pmss::service_options interrupt_options() {
+  pmss::service_options opts =
+      pmss::default_options(n_reactor, json_file, bdev_dev);
+  opts.interrupt_mode = true;
+  opts.adaptive_period_us = 1000;
+  opts.poll_wakeups = 200;
+  return opts;
+}
+
+// 定时器、yield和I/O在中断模式下都能被唤醒
+task<int> sleep_and_io(int idx) {
+  auto start = std::chrono::steady_clock::now();
+  co_await sleep_for(2000);
+  EXPECT_TRUE(std::chrono::steady_clock::now() - start >=
+              std::chrono::microseconds(2000));
+  co_await yield();
+  char* buf = (char*)spdk_dma_zmalloc(4096, 4096, nullptr);
+  snprintf(buf, 4096, "interrupt %d", idx);
+  EXPECT_TRUE(co_await pmss::write(buf, 4096, idx * 4096) == 0);
+  memset(buf, 0, 4096);
+  EXPECT_TRUE(co_await pmss::read(buf, 4096, idx * 4096) == 0);
+  char expect[64];
+  snprintf(expect, sizeof(expect), "interrupt %d", idx);
+  EXPECT_TRUE(strcmp(buf, expect) == 0);
+  spdk_dma_free(buf);
+  co_return idx;
+}
+
+task<int> busy() {
+  for (int i = 0; i < n_yield; ++i)
+    co_await yield();
+  co_return 0;
+}
+
+TEST(interrupt_mode, run) {
+  pmss::init_service(interrupt_options());
+  std::vector<task<int>> ts;
+  for (int i = 0; i < 4 * n_reactor; ++i)
+    ts.push_back(sleep_and_io(i));
+  auto results = pmss::run_all(ts);
+  pmss::deinit_service();
+  for (int i = 0; i < 4 * n_reactor; ++i)
+    EXPECT_TRUE(results[i] && *results[i] == i);
+}
+
+// 常驻模式：空闲的时候外部线程提交的task通过eventfd唤醒reactor；
+// 一阵密集的yield让reactor切换到轮询模式，之后空闲下来再切换回中断模式
+TEST(interrupt_mode, adaptive_persistent_service) {
+  pmss::start_service(interrupt_options());
+  for (int i = 0; i < 4; ++i) {
+    EXPECT_TRUE(pmss::submit(sleep_and_io(i)).get() == i);
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+
+  std::vector<std::future<int>> futures;
+  for (int i = 0; i < n_burst; ++i)
+    futures.push_back(pmss::submit(busy()));
+  for (auto& f : futures)
+    EXPECT_TRUE(f.get() == 0);
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  EXPECT_TRUE(pmss::submit(sleep_and_io(4)).get() == 4);
+  pmss::stop_service();
+  // 至少切换到轮询模式一次，再切换回来一次
+  EXPECT_TRUE(pmss::mode_switches >= 2);
+}
@@ -0,0 +1,66 @@
+#include "conditionvariable.hpp"
+#include "mutex.hpp"
+#include "sharedmutex.hpp"
+#include "spinlock.hpp"
+#include "task.hpp"
+#include <gtest/gtest.h>
+#include <cstdlib>
+#include <new>
+#include "common.hpp"
+
+// 统计当前线程上的堆分配次数，用来检查没有竞争时加锁解锁不分配协程帧
+static thread_local long n_alloc = 0;
+
+void* operator new(std::size_t size) {
+  ++n_alloc;
+  void* p = std::malloc(size ? size : 1);
+  if (p == nullptr)
+    throw std::bad_alloc();
+  return p;
+}
+
+void operator delete(void* p) noexcept {
+  std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+  std::free(p);
+}
+
+const int n_round = 1000;
+
+async_simple::coro::SpinLock spinlock;
+async_simple::coro::Mutex mutex;
+async_simple::coro::SharedMutex smutex;
+async_simple::coro::ConditionVariable<async_simple::coro::SpinLock> cv;
+bool ready = true;
+long allocs = -1;
+
+task<int> uncontended() {
+  long before = n_alloc;
+  for (int i = 0; i < n_round; ++i) {
+    co_await spinlock.coLock();
+    co_await cv.wait(spinlock, [] { return ready; });
+    spinlock.unlock();
+
+    co_await mutex.coLock();
+    mutex.unlock();
+
+    co_await smutex.coLock();
+    co_await smutex.unlock();
+    co_await smutex.coLockShared();
+    co_await smutex.coLockShared();
+    co_await smutex.unlockShared();
+    co_await smutex.unlockShared();
+  }
+  allocs = n_alloc - before;
+  co_return 0;
+}
+
+TEST(lock_alloc, uncontended_lock_no_alloc) {
+  pmss::init_service(1, json_file, bdev_dev);
+  pmss::add_task(uncontended());
+  pmss::run();
+  pmss::deinit_service();
+  EXPECT_TRUE(allocs == 0);
+}
@@ -0,0 +1,111 @@
+#include "schedule.hpp"
+#include "task.hpp"
+#include <chrono>
+#include <cstdio>
+#include <future>
+#include <gtest/gtest.h>
+#include <stdexcept>
+#include <thread>
+#include "common.hpp"
+
+const int n_reactor = 4;
+const int n_client = 4;
+const int n_submit = 5000;
+const int n_restart = 20;
+
+task<long> work(long x) {
+  if (x % 4 == 0)
+    co_await yield();
+  co_return x + 1;
+}
+
+std::atomic<int> void_done = 0;
+
+task<int> where() {
+  co_await yield();
+  co_return (int)spdk_env_get_current_core();
+}
+
+task<void> touch() {
+  co_await yield();
+  void_done.fetch_add(1);
+}
+
+task<int> fails() {
+  co_await yield();
+  throw std::runtime_error("bad request");
+}
+
+// 外部线程反复提交，reactor只启动一次
+TEST(persistent_service, submit_from_external_threads) {
+  pmss::start_service(n_reactor, json_file, bdev_dev);
+
+  std::atomic<long> submit_ns = 0;
+  std::vector<std::thread> clients;
+  for (int c = 0; c < n_client; ++c) {
+    clients.emplace_back([c, &submit_ns] {
+      std::vector<std::future<long>> futures;
+      futures.reserve(n_submit);
+      auto begin = std::chrono::steady_clock::now();
+      for (long i = 0; i < n_submit; ++i)
+        futures.push_back(pmss::submit(work(c * n_submit + i)));
+      auto end = std::chrono::steady_clock::now();
+      submit_ns.fetch_add(
+          std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin)
+              .count());
+      for (long i = 0; i < n_submit; ++i)
+        EXPECT_TRUE(futures[i].get() == c * n_submit + i + 1);
+    });
+  }
+  for (auto& t : clients)
+    t.join();
+  fprintf(stderr, "average submit latency: %.1lf ns\n",
+          submit_ns.load() / (double)(n_client * n_submit));
+
+  // 第二批，中间不需要重启
+  pmss::submit(touch()).get();
+  EXPECT_TRUE(void_done.load() == 1);
+  auto f = pmss::submit(fails());
+  bool caught = false;
+  try {
+    f.get();
+  } catch (const std::runtime_error&) {
+    caught = true;
+  }
+  EXPECT_TRUE(caught);
+
+  // 指定reactor，task一直在那个reactor上运行
+  std::vector<std::future<int>> cores;
+  for (int i = 0; i < 4 * n_reactor; ++i)
+    cores.push_back(pmss::submit(i % n_reactor, where()));
+  for (int i = 0; i < 4 * n_reactor; ++i)
+    EXPECT_TRUE(cores[i].get() == i % n_reactor);
+
+  pmss::stop_service();
+}
+
+// get()返回之后马上stop_service()：包装协程在兑现promise之前已经rcu_offline，
+// 之后不再访问服务的状态，退出时释放的RCU读者状态不会再被它写到
+TEST(persistent_service, stop_right_after_get) {
+  for (int round = 0; round < n_restart; ++round) {
+    pmss::start_service(n_reactor, json_file, bdev_dev);
+    if (round % 2 == 0) {
+      EXPECT_TRUE(pmss::submit(work(round)).get() == round + 1);
+    } else {
+      int before = void_done.load();
+      pmss::submit(touch()).get();
+      EXPECT_TRUE(void_done.load() == before + 1);
+    }
+    pmss::stop_service();
+  }
+}
+
+// 外部线程池用submit(worker, task)指定spdk_thread，同样可以get()之后马上退出
+TEST(persistent_service, stop_right_after_get_on_worker) {
+  for (int round = 0; round < n_restart; ++round) {
+    pmss::start_service(n_reactor, json_file, bdev_dev);
+    int worker = 1 + round % (n_reactor - 1);
+    EXPECT_TRUE(pmss::submit(worker, where()).get() == worker);
+    pmss::stop_service();
+  }
+}
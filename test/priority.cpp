@@ -0,0 +1,167 @@
+#include <cstring>
+#include "schedule.hpp"
+#include "service.hpp"
+#include "task.hpp"
+#include <gtest/gtest.h>
+#include "common.hpp"
+
+const int n_round = 2000;
+const int n_background = 8;
+const int n_read = 20;
+const int io_depth = 2;
+
+// 只用一个reactor，高低优先级的协程在同一个就绪队列上竞争
+pmss::service_options single_reactor() {
+  return pmss::default_options(1, json_file, bdev_dev);
+}
+
+int low_progress = 0;
+int low_progress_when_high_done = -1;
+
+// 子协程没有设置优先级，继承co_await它的协程的
+task<int> spin(pmss::priority expect, int* progress) {
+  EXPECT_TRUE(co_await pmss::this_priority() == expect);
+  for (int i = 0; i < n_round; ++i) {
+    co_await yield();
+    if (progress)
+      ++*progress;
+  }
+  co_return 0;
+}
+
+task<int> background_spin() {
+  co_return co_await spin(pmss::priority::low, &low_progress);
+}
+
+task<int> foreground_spin() {
+  co_await spin(pmss::priority::high, nullptr);
+  low_progress_when_high_done = low_progress;
+  co_return 0;
+}
+
+int run_spin(int weight) {
+  low_progress = 0;
+  low_progress_when_high_done = -1;
+  pmss::service_options opts = single_reactor();
+  opts.high_priority_weight = weight;
+  pmss::init_service(opts);
+  // 后台任务先开始，前台的yield仍然排在它前面
+  pmss::add_task(background_spin().with_priority(pmss::priority::low));
+  pmss::add_task(foreground_spin());
+  pmss::run();
+  pmss::deinit_service();
+  EXPECT_TRUE(low_progress == n_round);
+  return low_progress_when_high_done;
+}
+
+TEST(priority, weighted_yield) {
+  int progress = run_spin(16);
+  // 每16轮高优先级恢复一个低优先级的协程
+  EXPECT_TRUE(progress >= 0 && progress <= n_round / 16 + 1);
+}
+
+TEST(priority, strict_yield) {
+  EXPECT_TRUE(run_spin(0) == 0);
+}
+
+int background_done = 0;
+int max_background_inflight = 0;
+
+task<int> background_io(int idx) {
+  char* buf = (char*)spdk_dma_zmalloc(4096, 4096, nullptr);
+  int errors = 0;
+  for (int i = 0; i < n_read; ++i)
+    errors += co_await pmss::read(buf, 4096, idx * 4096) != 0;
+  spdk_dma_free(buf);
+  // 低优先级的scan窗口也受background_io_depth限制
+  auto gen = pmss::scan(0, 16 * 4096, 4096, 16);
+  int blocks = 0;
+  while (auto block = co_await gen.next()) {
+    errors += block->res != 0;
+    ++blocks;
+  }
+  errors += blocks != 16;
+  ++background_done;
+  co_return errors;
+}
+
+// 前台任务一边做I/O一边检查后台的I/O没有超过限制
+task<int> foreground_io() {
+  char* buf = (char*)spdk_dma_zmalloc(4096, 4096, nullptr);
+  snprintf(buf, 4096, "foreground");
+  int errors = co_await pmss::write(buf, 4096, 0) != 0;
+  while (background_done < n_background) {
+    auto& w = pmss::local_worker();
+    max_background_inflight =
+        std::max(max_background_inflight, w.background_inflight);
+    memset(buf, 0, 4096);
+    errors += co_await pmss::read(buf, 4096, 0) != 0;
+    errors += strcmp(buf, "foreground") != 0;
+    co_await yield();
+  }
+  spdk_dma_free(buf);
+  co_return errors;
+}
+
+TEST(priority, background_io_depth) {
+  pmss::service_options opts = single_reactor();
+  opts.background_io_depth = io_depth;
+  pmss::init_service(opts);
+  std::vector<std::optional<int>> results(n_background + 1);
+  for (int i = 0; i < n_background; ++i)
+    pmss::add_task(background_io(i + 1).with_priority(pmss::priority::low),
+                   &results[i]);
+  pmss::add_task(foreground_io(), &results[n_background]);
+  pmss::run();
+  pmss::deinit_service();
+  for (auto& r : results)
+    EXPECT_TRUE(r && *r == 0);
+  EXPECT_TRUE(max_background_inflight > 0);
+  EXPECT_TRUE(max_background_inflight <= io_depth);
+  EXPECT_TRUE(pmss::workers[0].background_inflight == 0);
+}
+
+int scans_done = 0;
+int max_scan_inflight = 0;
+
+// 只有低优先级的scan：每个scan的窗口比名额大，几个scan一起也只能有
+// io_depth个读请求在飞
+task<int> background_scan() {
+  auto gen = pmss::scan(0, 64 * 4096, 4096, 16);
+  int errors = 0, blocks = 0;
+  while (auto block = co_await gen.next()) {
+    errors += block->res != 0;
+    ++blocks;
+  }
+  errors += blocks != 64;
+  ++scans_done;
+  co_return errors;
+}
+
+task<int> sample_scans() {
+  while (scans_done < n_background) {
+    max_scan_inflight = std::max(max_scan_inflight,
+                                 pmss::local_worker().background_inflight);
+    co_await yield();
+  }
+  co_return 0;
+}
+
+TEST(priority, background_scan_depth) {
+  pmss::service_options opts = single_reactor();
+  opts.background_io_depth = io_depth;
+  pmss::init_service(opts);
+  std::vector<std::optional<int>> results(n_background + 1);
+  for (int i = 0; i < n_background; ++i)
+    pmss::add_task(background_scan().with_priority(pmss::priority::low),
+                   &results[i]);
+  pmss::add_task(sample_scans(), &results[n_background]);
+  pmss::run();
+  pmss::deinit_service();
+  for (auto& r : results)
+    EXPECT_TRUE(r && *r == 0);
+  // scan的读请求也算在名额里
+  EXPECT_TRUE(max_scan_inflight > 0);
+  EXPECT_TRUE(max_scan_inflight <= io_depth);
+  EXPECT_TRUE(pmss::workers[0].background_inflight == 0);
+}
@@ -0,0 +1,39 @@
+#include "spinlock.hpp"
+#include "task.hpp"
+#include <gtest/gtest.h>
+#include "common.hpp"
+
+const int n_reactor = 4;
+const int n_task = 16;
+const int n_round = 20000;
+
+int counter = 0;
+bool in_critical = false;
+async_simple::coro::QueuedSpinLock qlock(64);
+
+task<int> qlock_test(int idx) {
+  for (int j = 0; j < n_round; j++) {
+    co_await qlock.coLock();
+    EXPECT_FALSE(in_critical);
+    in_critical = true;
+    counter++;
+    // 持锁挂起，其他等待者会自旋超过阈值然后挂起
+    if (j % 1000 == idx)
+      co_await yield();
+    in_critical = false;
+    qlock.unlock();
+  }
+  co_return 0;
+}
+
+TEST(queued_spinlock, fifo_handoff) {
+  pmss::init_service(n_reactor, json_file, bdev_dev);
+  for (int i = 0; i < n_task; i++) {
+    pmss::add_task(qlock_test(i));
+  }
+  pmss::run();
+  EXPECT_TRUE(counter == n_task * n_round);
+  EXPECT_TRUE(qlock.tryLock());
+  qlock.unlock();
+  pmss::deinit_service();
+}
@@ -0,0 +1,87 @@
+#include "rcuhashmap.h"
+#include "schedule.hpp"
+#include "task.hpp"
+#include <gtest/gtest.h>
+#include "common.hpp"
+
+const int n_reactor = 4;
+const int n_writer = 4;
+const int n_reader = 8;
+const int n_key = 20000;
+
+// 初始只有16个桶，写入过程中会连续扩容好几次
+pmss::cds::RcuHashMap<int, long> map(16);
+std::atomic<int> writers_done = 0;
+
+task<int> writer(int idx) {
+  for (int k = idx; k < n_key; k += n_writer) {
+    bool inserted = co_await map.insert(k, (long)k * 2);
+    EXPECT_TRUE(inserted);
+  }
+  // 重复插入失败
+  bool inserted = co_await map.insert(idx, 0);
+  EXPECT_FALSE(inserted);
+  writers_done.fetch_add(1);
+  co_return 0;
+}
+
+task<int> reader(int idx) {
+  int found = 0;
+  while (writers_done.load() < n_writer) {
+    for (int k = idx; k < n_key; k += 97) {
+      long v;
+      if (map.find(k, v)) {
+        // eraser可能已经开始覆盖奇数key
+        EXPECT_TRUE(v == (long)k * 2 || v == -k);
+        ++found;
+      }
+    }
+    co_await yield();
+  }
+  co_return found;
+}
+
+task<int> eraser() {
+  while (writers_done.load() < n_writer)
+    co_await yield();
+  co_await map.finish_resize();
+  EXPECT_FALSE(map.resizing());
+  for (int k = 0; k < n_key; ++k) {
+    long v = 0;
+    EXPECT_TRUE(map.find(k, v));
+    EXPECT_TRUE(v == (long)k * 2);
+  }
+
+  for (int k = 0; k < n_key; k += 2) {
+    bool erased = co_await map.erase(k);
+    EXPECT_TRUE(erased);
+  }
+  for (int k = 1; k < n_key; k += 2) {
+    bool inserted = co_await map.insert_or_assign(k, -k);
+    EXPECT_FALSE(inserted);
+  }
+  co_return 0;
+}
+
+TEST(rcu_hashmap, concurrent_update_lookup) {
+  pmss::init_service(n_reactor, json_file, bdev_dev);
+  for (int i = 0; i < n_writer; ++i)
+    pmss::add_task(writer(i));
+  for (int i = 0; i < n_reader; ++i)
+    pmss::add_task(reader(i));
+  pmss::add_task(eraser());
+  pmss::run();
+  pmss::deinit_service();
+
+  EXPECT_TRUE(map.bucket_count() > 16);
+  EXPECT_TRUE(map.size() == n_key / 2);
+  for (int k = 0; k < n_key; ++k) {
+    long v = 0;
+    if (k % 2 == 0) {
+      EXPECT_FALSE(map.contains(k));
+    } else {
+      EXPECT_TRUE(map.find(k, v));
+      EXPECT_TRUE(v == -k);
+    }
+  }
+}
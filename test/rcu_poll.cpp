@@ -0,0 +1,75 @@
+#include "rcu.hpp"
+#include "schedule.hpp"
+#include "task.hpp"
+#include <gtest/gtest.h>
+#include "common.hpp"
+#include <vector>
+
+struct Foo {
+  int a = 0;
+  int b = 0;
+};
+
+Foo* gp = new Foo();
+int n_round = 10000;
+int n_reader = 8;
+int freed = 0;
+
+struct retired {
+  Foo* p;
+  unsigned long cookie;
+};
+
+task<int> reader(int idx) {
+  for (int i = 0; i < n_round; i++) {
+    pmss::rcu::rcu_read_lock();
+    Foo* p = pmss::rcu::rcu_dereference(gp);
+    EXPECT_TRUE(p->a == p->b);
+    pmss::rcu::rcu_read_unlock();
+    if (i % 128 == 0)
+      co_await yield();
+  }
+  co_return 0;
+}
+
+// writer从不等待宽限期，只是把cookie和旧对象存起来，之后轮询回收
+task<int> writer(int idx) {
+  std::vector<retired> pending;
+  for (int i = 0; i < n_round; i++) {
+    Foo* p = new Foo();
+    p->a = i;
+    p->b = i;
+    Foo* q = gp;
+    pmss::rcu::rcu_assign_pointer(gp, p);
+    pending.push_back({q, pmss::rcu::start_poll_synchronize_rcu()});
+
+    size_t done = 0;
+    while (done < pending.size() &&
+           pmss::rcu::poll_state_synchronize_rcu(pending[done].cookie)) {
+      delete pending[done].p;
+      ++done;
+      ++freed;
+    }
+    pending.erase(pending.begin(), pending.begin() + done);
+    if (i % 64 == 0)
+      co_await yield();
+  }
+  for (auto& r : pending) {
+    co_await pmss::rcu::cond_synchronize_rcu(r.cookie);
+    delete r.p;
+    ++freed;
+  }
+  co_return 0;
+}
+
+TEST(rcu_poll, poll_reclaim) {
+  pmss::init_service(4, json_file, bdev_dev);
+  for (int i = 0; i < n_reader; i++) {
+    pmss::add_task(reader(i));
+  }
+  pmss::add_task(writer(0));
+  pmss::run();
+  EXPECT_TRUE(freed == n_round);
+  EXPECT_TRUE(gp->a == n_round - 1);
+  pmss::deinit_service();
+}
@@ -0,0 +1,106 @@
+#include "rcuradix.h"
+#include "schedule.hpp"
+#include "task.hpp"
+#include <gtest/gtest.h>
+#include "common.hpp"
+
+const int n_reactor = 4;
+const int n_writer = 4;
+const int n_reader = 4;
+const int n_page = 8192;
+
+// 模拟缓存页，index就是它在树里的下标
+struct page {
+  uint64_t index;
+};
+
+// 一半的页在低地址连续分布，另一半放到1<<40之后，插入过程中树会长高
+uint64_t page_index(int i) {
+  return i < n_page / 2 ? (uint64_t)i : (1ull << 40) + (uint64_t)i;
+}
+
+page pages[n_page];
+pmss::cds::RcuRadixTree<page> tree;
+std::atomic<int> writers_done = 0;
+std::atomic<int> erasers_done = 0;
+
+task<int> writer(int idx) {
+  for (int i = idx; i < n_page; i += n_writer) {
+    pages[i].index = page_index(i);
+    bool inserted = co_await tree.insert(pages[i].index, &pages[i]);
+    EXPECT_TRUE(inserted);
+  }
+  bool inserted = co_await tree.insert(page_index(idx), &pages[idx]);
+  EXPECT_FALSE(inserted);
+  writers_done.fetch_add(1);
+  co_return 0;
+}
+
+task<int> reader(int idx) {
+  page* results[64];
+  uint64_t indices[64];
+  int found = 0;
+  while (erasers_done.load() < 1) {
+    pmss::rcu::rcu_read_lock();
+    for (int i = idx; i < n_page; i += 31) {
+      page* p = tree.lookup(page_index(i));
+      if (p) {
+        EXPECT_TRUE(p->index == page_index(i));
+        ++found;
+      }
+    }
+    // 跨越两段地址的批量查找，下标必须递增且与条目一致
+    unsigned n = tree.gang_lookup(page_index(n_page / 2 - 32 + idx), 64,
+                                  results, indices);
+    for (unsigned k = 0; k < n; ++k) {
+      EXPECT_TRUE(results[k]->index == indices[k]);
+      if (k > 0)
+        EXPECT_TRUE(indices[k] > indices[k - 1]);
+    }
+    pmss::rcu::rcu_read_unlock();
+    ++idx;
+    co_await yield();
+  }
+  co_return found;
+}
+
+// 删除低地址的页，之后树高会降回去
+task<int> eraser() {
+  while (writers_done.load() < n_writer)
+    co_await yield();
+  for (int i = 0; i < n_page / 2; ++i) {
+    page* p = co_await tree.erase(page_index(i));
+    EXPECT_TRUE(p == &pages[i]);
+  }
+  page* p = co_await tree.erase(0);
+  EXPECT_TRUE(p == nullptr);
+  erasers_done.fetch_add(1);
+  co_return 0;
+}
+
+TEST(rcu_radix, concurrent_insert_gang_lookup) {
+  pmss::init_service(n_reactor, json_file, bdev_dev);
+  for (int i = 0; i < n_writer; ++i)
+    pmss::add_task(writer(i));
+  for (int i = 0; i < n_reader; ++i)
+    pmss::add_task(reader(i));
+  pmss::add_task(eraser());
+  pmss::run();
+  pmss::deinit_service();
+
+  EXPECT_TRUE(tree.size() == n_page / 2);
+  page* results[n_page];
+  uint64_t indices[n_page];
+  pmss::rcu::rcu_read_lock();
+  EXPECT_TRUE(tree.lookup(0) == nullptr);
+  EXPECT_TRUE(tree.lookup(page_index(n_page - 1)) == &pages[n_page - 1]);
+  unsigned n = tree.gang_lookup(0, n_page, results, indices);
+  EXPECT_TRUE(n == n_page / 2);
+  for (unsigned k = 0; k < n; ++k) {
+    EXPECT_TRUE(results[k] == &pages[n_page / 2 + k]);
+    EXPECT_TRUE(indices[k] == page_index(n_page / 2 + k));
+  }
+  n = tree.gang_lookup(page_index(n_page - 10), 64, results);
+  EXPECT_TRUE(n == 10);
+  pmss::rcu::rcu_read_unlock();
+}
@@ -0,0 +1,80 @@
+#include <atomic>
+#include <thread>
+#include "rcu.hpp"
+#include "schedule.hpp"
+#include "service.hpp"
+#include "task.hpp"
+#include <gtest/gtest.h>
+#include "common.hpp"
+
+// 两个核，每个核两个spdk_thread：编号0和2在核0上，1和3在核1上
+const int n_reactor = 2;
+const int reader_a = 0;
+const int reader_b = 2;
+const int writer_worker = 1;
+
+std::atomic<bool> b_waiting = false;
+std::atomic<bool> a_locked = false;
+std::atomic<bool> b_locked = false;
+std::atomic<bool> a_offline = false;
+std::atomic<bool> checked = false;
+std::atomic<bool> grace_period_done = false;
+
+// 等待的时候不能yield（yield会rcu_offline），用I/O挂起，I/O不改变读者状态
+task<int> wait_without_offline(std::atomic<bool>& flag) {
+  char* buf = (char*)spdk_dma_zmalloc(4096, 4096, nullptr);
+  while (!flag.load())
+    co_await pmss::read(buf, 4096, 0);
+  spdk_dma_free(buf);
+  co_return 0;
+}
+
+// 同一个reactor上：B先rcu_offline，A进入读端临界区，B再进入读端临界区，
+// 然后A退出。B必须发布了自己的版本号，不能因为A的计数被跳过，
+// 否则A退出之后写者会认为宽限期已经结束
+task<int> reader_b_task() {
+  b_waiting.store(true);
+  while (!a_locked.load())
+    co_await yield();
+  pmss::rcu::rcu_read_lock();
+  b_locked.store(true);
+  co_await wait_without_offline(checked);
+  pmss::rcu::rcu_read_unlock();
+  co_return 0;
+}
+
+task<int> reader_a_task() {
+  co_await wait_without_offline(b_waiting);
+  pmss::rcu::rcu_read_lock();
+  a_locked.store(true);
+  co_await wait_without_offline(b_locked);
+  pmss::rcu::rcu_read_unlock();
+  pmss::rcu::rcu_offline();
+  a_offline.store(true);
+  co_return 0;
+}
+
+task<int> writer_task() {
+  while (!a_offline.load())
+    std::this_thread::yield();
+  unsigned long cookie = pmss::rcu::start_poll_synchronize_rcu();
+  grace_period_done.store(pmss::rcu::poll_state_synchronize_rcu(cookie));
+  checked.store(true);
+  co_return 0;
+}
+
+TEST(rcu_shared_reactor, reader_publishes_after_offline) {
+  pmss::service_options opts =
+      pmss::default_options(n_reactor, json_file, bdev_dev);
+  opts.threads_per_core = 2;
+  pmss::start_service(opts);
+  auto a = pmss::submit(reader_a, reader_a_task());
+  auto b = pmss::submit(reader_b, reader_b_task());
+  auto w = pmss::submit(writer_worker, writer_task());
+  EXPECT_TRUE(a.get() == 0);
+  EXPECT_TRUE(b.get() == 0);
+  EXPECT_TRUE(w.get() == 0);
+  pmss::stop_service();
+  // B还在读端临界区里，宽限期不能结束
+  EXPECT_FALSE(grace_period_done.load());
+}
@@ -0,0 +1,101 @@
+#include "rcuskiplist.h"
+#include "schedule.hpp"
+#include "task.hpp"
+#include <gtest/gtest.h>
+#include "common.hpp"
+
+const int n_reactor = 4;
+const int n_writer = 4;
+const int n_reader = 4;
+const int n_key = 10000;
+
+pmss::cds::RcuSkipList<int, long> list;
+std::atomic<int> writers_done = 0;
+std::atomic<int> updaters_done = 0;
+
+task<int> writer(int idx) {
+  // 相邻的key由不同的写者插入，前驱节点上的锁竞争最激烈
+  for (int k = idx; k < n_key; k += n_writer) {
+    bool inserted = co_await list.insert(k, (long)k * 2);
+    EXPECT_TRUE(inserted);
+  }
+  bool inserted = co_await list.insert(idx, 0);
+  EXPECT_FALSE(inserted);
+  writers_done.fetch_add(1);
+  co_return 0;
+}
+
+// 范围扫描过程中key必须严格递增
+task<int> reader(int idx) {
+  int scanned = 0;
+  while (updaters_done.load() < 3) {
+    int lo = (idx * 997) % n_key;
+    int prev = -1;
+    scanned += list.range(lo, lo + 500, [&](const int& k, const long& v) {
+      EXPECT_TRUE(k > prev);
+      EXPECT_TRUE(k >= lo && k < lo + 500);
+      EXPECT_TRUE(v == (long)k * 2 || v == -k);
+      prev = k;
+    });
+    ++idx;
+    co_await yield();
+  }
+  co_return scanned;
+}
+
+// 删除偶数key
+task<int> eraser(int idx) {
+  while (writers_done.load() < n_writer)
+    co_await yield();
+  for (int k = idx * 2; k < n_key; k += 4) {
+    bool erased = co_await list.erase(k);
+    EXPECT_TRUE(erased);
+  }
+  updaters_done.fetch_add(1);
+  co_return 0;
+}
+
+// 持有节点锁期间挂起，再把奇数key的值改成-k
+task<int> updater() {
+  while (writers_done.load() < n_writer)
+    co_await yield();
+  for (int k = 1; k < n_key; k += 2) {
+    bool updated = co_await list.update(k, [k](const long& old) -> task<long> {
+      EXPECT_TRUE(old == (long)k * 2);
+      co_await yield();
+      co_return -k;
+    });
+    EXPECT_TRUE(updated);
+  }
+  bool updated = co_await list.update(
+      n_key, [](const long&) -> task<long> { co_return 0; });
+  EXPECT_FALSE(updated);
+  updaters_done.fetch_add(1);
+  co_return 0;
+}
+
+TEST(rcu_skiplist, concurrent_update_scan) {
+  pmss::init_service(n_reactor, json_file, bdev_dev);
+  for (int i = 0; i < n_writer; ++i)
+    pmss::add_task(writer(i));
+  for (int i = 0; i < n_reader; ++i)
+    pmss::add_task(reader(i));
+  pmss::add_task(eraser(0));
+  pmss::add_task(eraser(1));
+  pmss::add_task(updater());
+  pmss::run();
+  pmss::deinit_service();
+
+  EXPECT_TRUE(list.size() == n_key / 2);
+  int expect = 1;
+  pmss::rcu::rcu_read_lock();
+  for (auto it = list.lower_bound(0); it != list.end(); ++it) {
+    EXPECT_TRUE(it.key() == expect);
+    EXPECT_TRUE(it.value() == -expect);
+    expect += 2;
+  }
+  pmss::rcu::rcu_read_unlock();
+  EXPECT_TRUE(expect == n_key + 1);
+  EXPECT_TRUE(list.lower_bound(n_key) == list.end());
+  EXPECT_TRUE(list.lower_bound(100).key() == 101);
+}
@@ -0,0 +1,96 @@
+#include "schedule.hpp"
+#include "task.hpp"
+#include <gtest/gtest.h>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include "common.hpp"
+
+const int n_reactor = 4;
+const int n_task = 64;
+
+task<long> square(long x) {
+  if (x % 3 == 0)
+    co_await yield();
+  co_return x * x;
+}
+
+// 记录每个task实际运行在哪个核上
+task<int> where(int idx) {
+  co_await yield();
+  co_return (int)spdk_env_get_current_core();
+}
+
+task<std::string> name(int idx) {
+  co_await yield();
+  if (idx == 2)
+    throw std::runtime_error("no name");
+  co_return "task" + std::to_string(idx);
+}
+
+// 只能移动的返回值，经过子协程再返回一次
+task<std::unique_ptr<int>> boxed(int idx) {
+  co_await yield();
+  co_return std::make_unique<int>(idx);
+}
+
+task<std::unique_ptr<int>> reboxed(int idx) {
+  std::unique_ptr<int> p = co_await boxed(idx);
+  *p += 1;
+  co_return p;
+}
+
+std::atomic<int> void_done = 0;
+
+task<void> side_effect() {
+  co_await yield();
+  void_done.fetch_add(1);
+}
+
+// 不同返回类型的task可以一起运行，结果按提交的顺序返回
+TEST(run_all, typed_results) {
+  pmss::init_service(n_reactor, json_file, bdev_dev);
+  std::vector<task<long>> squares;
+  for (long i = 0; i < n_task; ++i)
+    squares.push_back(square(i));
+  std::vector<std::optional<std::string>> names(4);
+  for (int i = 0; i < 4; ++i)
+    pmss::add_task(name(i), &names[i]);
+  pmss::add_task(side_effect());
+  auto results = pmss::run_all(squares);
+  pmss::deinit_service();
+
+  EXPECT_TRUE(results.size() == (size_t)n_task);
+  for (long i = 0; i < n_task; ++i)
+    EXPECT_TRUE(results[i] && *results[i] == i * i);
+  EXPECT_TRUE(names[0] && *names[0] == "task0");
+  EXPECT_TRUE(names[3] && *names[3] == "task3");
+  // 抛出异常的task没有结果
+  EXPECT_FALSE(names[2].has_value());
+  EXPECT_TRUE(void_done.load() == 1);
+
+  // 第二轮：round robin派发，第i个task运行在第i % n_reactor个核上
+  pmss::init_service(n_reactor, json_file, bdev_dev);
+  std::vector<task<int>> wheres;
+  for (int i = 0; i < n_task; ++i)
+    wheres.push_back(where(i));
+  std::optional<long> single;
+  pmss::add_task(square(7), &single);
+  auto cores = pmss::run_all(wheres);
+  pmss::deinit_service();
+  // 先add_task的square(7)占了核0
+  for (int i = 0; i < n_task; ++i)
+    EXPECT_TRUE(cores[i] && *cores[i] == (i + 1) % n_reactor);
+  EXPECT_TRUE(single && *single == 49);
+}
+
+TEST(run_all, move_only_results) {
+  pmss::init_service(n_reactor, json_file, bdev_dev);
+  std::vector<task<std::unique_ptr<int>>> ts;
+  for (int i = 0; i < n_task; ++i)
+    ts.push_back(reboxed(i));
+  auto results = pmss::run_all(ts);
+  pmss::deinit_service();
+  for (int i = 0; i < n_task; ++i)
+    EXPECT_TRUE(results[i] && *results[i] && **results[i] == i + 1);
+}
@@ -0,0 +1,72 @@
+#include "latch.hpp"
+#include "semaphore.hpp"
+#include "task.hpp"
+#include <gtest/gtest.h>
+#include "common.hpp"
+
+const int n_reactor = 4;
+const int n_task = 16;
+const int n_round = 2000;
+const int n_permit = 3;
+
+async_simple::coro::CountingSemaphore sem(n_permit);
+async_simple::coro::Latch start_latch(1);
+async_simple::coro::Latch done_latch(n_task);
+async_simple::coro::Barrier barrier(n_task);
+std::atomic<int> inflight = 0;
+std::atomic<int> max_inflight = 0;
+std::atomic<int> phase_arrived[8];
+std::atomic<int> started = 0;
+
+task<int> worker(int idx) {
+  started.fetch_add(1);
+  co_await start_latch.wait();
+
+  // 同时持有许可的协程不超过n_permit个
+  for (int i = 0; i < n_round; ++i) {
+    co_await sem.coAcquire();
+    int cur = inflight.fetch_add(1) + 1;
+    int m = max_inflight.load();
+    while (cur > m && !max_inflight.compare_exchange_weak(m, cur))
+      ;
+    if (i % 16 == idx % 16)
+      co_await yield();
+    inflight.fetch_sub(1);
+    sem.release();
+  }
+
+  // 每一轮所有协程都到达之后才能进入下一轮
+  for (int phase = 0; phase < 8; ++phase) {
+    phase_arrived[phase].fetch_add(1);
+    co_await barrier.arriveAndWait();
+    EXPECT_TRUE(phase_arrived[phase].load() == n_task);
+  }
+
+  co_await done_latch.arriveAndWait();
+  EXPECT_TRUE(done_latch.tryWait());
+  co_return 0;
+}
+
+// 等所有worker都开始等待之后再打开start_latch
+task<int> starter() {
+  while (started.load() < n_task)
+    co_await yield();
+  EXPECT_FALSE(start_latch.tryWait());
+  start_latch.countDown();
+  co_await done_latch.wait();
+  co_return 0;
+}
+
+TEST(semaphore, latch_barrier) {
+  pmss::init_service(n_reactor, json_file, bdev_dev);
+  for (int i = 0; i < n_task; ++i)
+    pmss::add_task(worker(i));
+  pmss::add_task(starter());
+  pmss::run();
+  pmss::deinit_service();
+
+  EXPECT_TRUE(max_inflight.load() <= n_permit);
+  EXPECT_TRUE(max_inflight.load() >= 1);
+  EXPECT_TRUE(sem.available() == n_permit);
+  EXPECT_TRUE(sem.tryAcquire());
+}
@@ -0,0 +1,113 @@
+#include "brlock.hpp"
+#include "rcu.hpp"
+#include "schedule.hpp"
+#include "task.hpp"
+#include <gtest/gtest.h>
+#include "common.hpp"
+
+const int n_task = 32;
+
+task<int> where() {
+  co_await yield();
+  co_return (int)spdk_env_get_current_core();
+}
+
+// 返回值：核号 * 1000 + spdk_thread的编号
+task<int> lock_and_sync() {
+  static async_simple::coro::BrLock brlock;
+  co_await brlock.coLockShared();
+  co_await yield();
+  brlock.unlockShared();
+  co_await brlock.coLock();
+  brlock.unlock();
+  pmss::rcu::rcu_read_lock();
+  pmss::rcu::rcu_read_unlock();
+  co_await pmss::rcu::synchronize_rcu();
+  co_return (int)spdk_env_get_current_core() * 1000 + pmss::worker_index();
+}
+
+std::vector<std::optional<int>> run_on(const std::vector<uint32_t>& cores,
+                                       task<int> (*f)() = where) {
+  pmss::service_options opts;
+  opts.config_file = json_file;
+  opts.bdev_name = bdev_dev;
+  opts.cores = cores;
+  opts.mem_size = 512;
+  pmss::init_service(opts);
+  std::vector<task<int>> ts;
+  for (int i = 0; i < n_task; ++i)
+    ts.push_back(f());
+  auto results = pmss::run_all(ts);
+  pmss::deinit_service();
+  return results;
+}
+
+// 核不从0开始、不连续，编号超过56的核也不会让cpumask溢出。
+// 只检查生成的mask和配置，不启动reactor，不需要本机真的有这些核
+TEST(service_options, arbitrary_core_list) {
+  pmss::service_options opts;
+  opts.config_file = json_file;
+  opts.bdev_name = bdev_dev;
+  opts.cores = {2, 61, 100};
+  opts.mem_size = 512;
+  pmss::init_service(opts);
+  EXPECT_TRUE(pmss::cpumask == "[2,61,100]");
+  EXPECT_TRUE(pmss::num_threads == 3);
+  EXPECT_TRUE(pmss::options.mem_size == 512);
+  EXPECT_FALSE(pmss::options.hugepages);
+}
+
+// 真的启动reactor：在本机可用的核里隔一个取一个，跳过编号最小的核，
+// 这样核不从0开始也不连续。可用的核不够时跳过
+TEST(service_options, run_on_sparse_host_cores) {
+  std::vector<uint32_t> all = host_cores();
+  std::vector<uint32_t> cores;
+  for (size_t i = 1; i < all.size() && cores.size() < 3; i += 2)
+    cores.push_back(all[i]);
+  if (cores.size() < 2)
+    GTEST_SKIP();
+  auto results = run_on(cores);
+  EXPECT_TRUE(pmss::num_threads == (int)cores.size());
+  for (int i = 0; i < n_task; ++i)
+    EXPECT_TRUE(results[i] && *results[i] == (int)cores[i % cores.size()]);
+}
+
+// 核号超过256并且很稀疏：每个spdk_thread的状态按编号索引，个数只和核数有关。
+// 只检查编号和核的对应关系，不启动reactor
+TEST(service_options, sparse_high_cores) {
+  pmss::service_options opts;
+  opts.config_file = json_file;
+  opts.bdev_name = bdev_dev;
+  opts.cores = {1, 300, 383};
+  opts.threads_per_core = 2;
+  pmss::init_service(opts);
+  EXPECT_TRUE(pmss::cpumask == "[1,300,383]");
+  EXPECT_TRUE(pmss::num_workers == 6);
+  for (int k = 0; k < pmss::num_workers; ++k)
+    EXPECT_TRUE(pmss::workers[k].core == opts.cores[k % 3]);
+}
+
+// 真的启动：用本机编号最小、中间和最大的核，RCU和BrLock只扫描这几个spdk_thread，
+// spdk_thread的id到编号的映射覆盖每一个spdk_thread。可用的核不够时跳过
+TEST(service_options, sparse_host_cores_rcu_brlock) {
+  std::vector<uint32_t> all = host_cores();
+  if (all.size() < 2)
+    GTEST_SKIP();
+  std::vector<uint32_t> cores{all.front()};
+  if (all.size() >= 3)
+    cores.push_back(all[all.size() / 2]);
+  cores.push_back(all.back());
+  auto results = run_on(cores, lock_and_sync);
+  for (int i = 0; i < n_task; ++i) {
+    int k = i % cores.size();
+    EXPECT_TRUE(results[i] && *results[i] == (int)cores[k] * 1000 + k);
+  }
+  EXPECT_TRUE(pmss::num_workers == (int)cores.size());
+  std::vector<int> seen(pmss::num_workers, 0);
+  for (int k : pmss::thread_worker) {
+    if (k >= 0)
+      ++seen[k];
+  }
+  for (int n : seen)
+    EXPECT_TRUE(n == 1);
+}
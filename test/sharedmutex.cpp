@@ -0,0 +1,57 @@
+#include "sharedmutex.hpp"
+#include "task.hpp"
+#include <gtest/gtest.h>
+#include "common.hpp"
+
+const int n_reactor = 4;
+const int n_reader = 12;
+const int n_writer = 4;
+const int n_round = 20000;
+
+async_simple::coro::SharedMutex smutex;
+// 写者持锁期间a和b不相等
+long a = 0, b = 0;
+std::atomic<int> active_readers = 0;
+std::atomic<long> read_cnt = 0;
+
+task<int> reader(int idx) {
+  for (int i = 0; i < n_round; ++i) {
+    co_await smutex.coLockShared();
+    active_readers.fetch_add(1);
+    EXPECT_TRUE(a == b);
+    if (i % 256 == idx)
+      co_await yield();
+    EXPECT_TRUE(a == b);
+    active_readers.fetch_sub(1);
+    co_await smutex.unlockShared();
+  }
+  read_cnt.fetch_add(n_round);
+  co_return 0;
+}
+
+task<int> writer(int idx) {
+  for (int i = 0; i < n_round / 10; ++i) {
+    co_await smutex.coLock();
+    EXPECT_TRUE(active_readers.load() == 0);
+    ++a;
+    if (i % 64 == idx)
+      co_await yield();
+    ++b;
+    co_await smutex.unlock();
+  }
+  co_return 0;
+}
+
+TEST(sharedmutex, readers_writers) {
+  pmss::init_service(n_reactor, json_file, bdev_dev);
+  for (int i = 0; i < n_reader; ++i)
+    pmss::add_task(reader(i));
+  for (int i = 0; i < n_writer; ++i)
+    pmss::add_task(writer(i));
+  pmss::run();
+  pmss::deinit_service();
+
+  EXPECT_TRUE(a == n_writer * (n_round / 10));
+  EXPECT_TRUE(a == b);
+  EXPECT_TRUE(read_cnt.load() == (long)n_reader * n_round);
+}
@@ -19,8 +19,50 @@ task<int> simple_write_read() {
   co_return 0;
 }
 
+// 先发起几个I/O再依次等待，co_await之前可能已经完成了
+task<int> overlapped_write_read() {
+  const int n_io = 4;
+  char* bufs[n_io];
+  for (int i = 0; i < n_io; ++i) {
+    bufs[i] = (char*)spdk_dma_zmalloc(4096, 4096, nullptr);
+    snprintf(bufs[i], 4096, "block %d", i);
+  }
+  auto w0 = pmss::start_write(bufs[0], 4096, 0);
+  auto w1 = pmss::start_write(bufs[1], 4096, 4096);
+  auto w2 = pmss::start_write(bufs[2], 4096, 2 * 4096);
+  auto w3 = pmss::start_write(bufs[3], 4096, 3 * 4096);
+  co_await yield();
+  EXPECT_TRUE(co_await w3 == 0);
+  EXPECT_TRUE(co_await w0 == 0);
+  EXPECT_TRUE(co_await w1 == 0);
+  EXPECT_TRUE(co_await w2 == 0);
+  for (int i = 0; i < n_io; ++i)
+    memset(bufs[i], 0, 4096);
+  auto r0 = pmss::start_read(bufs[0], 4096, 0);
+  auto r1 = pmss::start_read(bufs[1], 4096, 4096);
+  auto r2 = pmss::start_read(bufs[2], 4096, 2 * 4096);
+  auto r3 = pmss::start_read(bufs[3], 4096, 3 * 4096);
+  EXPECT_TRUE(co_await r0 + co_await r1 + co_await r2 + co_await r3 == 0);
+  // 同步失败的请求不挂起，直接拿到错误码
+  auto bad = pmss::start_read(bufs[0], 100, 0);
+  EXPECT_TRUE(co_await bad < 0);
+  for (int i = 0; i < n_io; ++i) {
+    char expect[64];
+    snprintf(expect, sizeof(expect), "block %d", i);
+    EXPECT_TRUE(strcmp(bufs[i], expect) == 0);
+    spdk_dma_free(bufs[i]);
+  }
+  co_return 0;
+}
+
 TEST(simple_io, simple_write_read) {
   pmss::init_service(1, json_file, bdev_dev);
   pmss::run(simple_write_read());
   pmss::deinit_service();
 }
+
+TEST(simple_io, overlapped_write_read) {
+  pmss::init_service(1, json_file, bdev_dev);
+  pmss::run(overlapped_write_read());
+  pmss::deinit_service();
+}
@@ -0,0 +1,75 @@
+#include "spscring.hpp"
+#include "task.hpp"
+#include <gtest/gtest.h>
+#include "common.hpp"
+
+const int n_reactor = 2;
+const long n_item = 200000;
+
+// 只能移动，emplace时直接在环上构造
+struct item {
+  item(long seq, long check) : seq(seq), check(check) {}
+  item(const item&) = delete;
+  item(item&&) = default;
+  item& operator=(item&&) = default;
+  long seq;
+  long check;
+};
+
+// 容量小于批量大小时批量会被截断到容量
+async_simple::coro::SpscRing<item> ring(64, 128);
+async_simple::coro::SpscRing<long> slow_ring(8, 4, 0);
+long received = 0;
+long slow_received = 0;
+bool in_order = true;
+
+task<int> producer() {
+  for (long i = 0; i < n_item; ++i) {
+    while (!ring.tryEmplace(i, i * 3 + 1))
+      co_await yield();
+    // 偶尔停下来，让消费者把队列取空然后挂起
+    if (i % 4096 == 0)
+      for (int j = 0; j < 8; ++j)
+        co_await yield();
+  }
+  ring.close();
+
+  // 不自旋，每次队列空都挂起，只靠flush唤醒
+  for (long i = 0; i < 1000; ++i) {
+    while (!slow_ring.tryEmplace(i))
+      co_await yield();
+    slow_ring.flush();
+    co_await yield();
+  }
+  slow_ring.close();
+  co_return 0;
+}
+
+task<int> consumer() {
+  while (auto v = co_await ring.pop()) {
+    if (v->seq != received || v->check != received * 3 + 1)
+      in_order = false;
+    ++received;
+  }
+  while (auto v = co_await slow_ring.pop()) {
+    if (*v != slow_received)
+      in_order = false;
+    ++slow_received;
+  }
+  co_return 0;
+}
+
+TEST(spscring, ordered_handoff) {
+  pmss::init_service(n_reactor, json_file, bdev_dev);
+  // round robin，生产者和消费者在不同的核上
+  pmss::add_task(producer());
+  pmss::add_task(consumer());
+  pmss::run();
+  pmss::deinit_service();
+
+  EXPECT_TRUE(in_order);
+  EXPECT_TRUE(received == n_item);
+  EXPECT_TRUE(slow_received == 1000);
+  EXPECT_TRUE(ring.capacity() == 64);
+  EXPECT_FALSE(ring.tryPop().has_value());
+}
@@ -0,0 +1,117 @@
+#include <future>
+#include "schedule.hpp"
+#include "task.hpp"
+#include <gtest/gtest.h>
+#include <cstdlib>
+#include <new>
+#include "common.hpp"
+
+const int n_reactor = 4;
+const int n_task = 1000;
+
+// 统计还没有释放的、tracking为true时在当前线程上分配的内存。
+// 每块前面多分配一个头记录它是不是要统计的，释放时（可能在别的线程上）
+// 看头就知道要不要减，不需要另外的表
+static thread_local bool tracking = false;
+std::atomic<long> live_tracked = 0;
+
+struct alignas(alignof(std::max_align_t)) alloc_header {
+  bool tracked;
+};
+
+void* operator new(std::size_t size) {
+  void* p = std::malloc(sizeof(alloc_header) + size);
+  if (p == nullptr)
+    throw std::bad_alloc();
+  auto* h = static_cast<alloc_header*>(p);
+  h->tracked = tracking;
+  if (tracking)
+    live_tracked.fetch_add(1);
+  return h + 1;
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+  try {
+    return ::operator new(size);
+  } catch (...) {
+    return nullptr;
+  }
+}
+
+void operator delete(void* p) noexcept {
+  if (p == nullptr)
+    return;
+  auto* h = static_cast<alloc_header*>(p) - 1;
+  if (h->tracked)
+    live_tracked.fetch_sub(1);
+  std::free(h);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+  ::operator delete(p);
+}
+
+void operator delete(void* p, const std::nothrow_t&) noexcept {
+  ::operator delete(p);
+}
+
+// 用户task运行的时候看到的最大值，确认统计确实覆盖了包装协程
+std::atomic<long> peak_tracked = 0;
+std::atomic<int> finished = 0;
+
+task<int> short_task(int idx) {
+  long n = live_tracked.load();
+  long peak = peak_tracked.load();
+  while (n > peak && !peak_tracked.compare_exchange_weak(peak, n)) {
+  }
+  if (idx % 2 == 0)
+    co_await yield();
+  finished.fetch_add(1);
+  co_return idx;
+}
+
+// 同一个进程里可以多次run()，上一轮的task不会被再次派发，
+// 包装协程（task_run）结束之后帧自己释放，不需要保存在任何容器里
+TEST(task_lifetime, frames_freed_after_run) {
+  for (int round = 1; round <= 2; ++round) {
+    pmss::init_service(n_reactor, json_file, bdev_dev);
+    // 先分配好tasks，统计里只有add_task创建的包装协程的帧
+    pmss::tasks.reserve(n_task);
+    for (int i = 0; i < n_task; ++i) {
+      task<int> t = short_task(i);
+      tracking = true;
+      pmss::add_task(std::move(t));
+      tracking = false;
+    }
+    EXPECT_TRUE(live_tracked.load() == n_task);
+    pmss::run();
+    pmss::deinit_service();
+    EXPECT_TRUE(finished.load() == round * n_task);
+    EXPECT_TRUE(live_tracked.load() == 0);
+  }
+  EXPECT_TRUE(peak_tracked.load() > 0);
+}
+
+// 常驻模式下submit的包装协程（submit_run）也一样。
+// 统计里还有promise的共享状态，future都销毁之后才释放
+TEST(task_lifetime, submit_frames_freed) {
+  finished = 0;
+  peak_tracked = 0;
+  pmss::start_service(n_reactor, json_file, bdev_dev);
+  {
+    std::vector<std::future<int>> futures;
+    futures.reserve(n_task);
+    for (int i = 0; i < n_task; ++i) {
+      task<int> t = short_task(i);
+      tracking = true;
+      futures.push_back(pmss::submit(std::move(t)));
+      tracking = false;
+    }
+    for (int i = 0; i < n_task; ++i)
+      EXPECT_TRUE(futures[i].get() == i);
+  }
+  pmss::stop_service();
+  EXPECT_TRUE(finished.load() == n_task);
+  EXPECT_TRUE(live_tracked.load() == 0);
+  EXPECT_TRUE(peak_tracked.load() > 0);
+}
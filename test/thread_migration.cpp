@@ -0,0 +1,87 @@
+#include <chrono>
+#include <cstring>
+#include "schedule.hpp"
+#include "service.hpp"
+#include "task.hpp"
+#include <gtest/gtest.h>
+#include "common.hpp"
+
+const int n_reactor = 2;
+const int threads_per_core = 2;
+const int n_worker = n_reactor * threads_per_core;
+// 迁移之后再做这么多次I/O，确认换了核之后io channel还能用
+const int n_round_after_move = 200;
+
+task<int> io_round(int idx, long round, char* buf) {
+  snprintf(buf, 4096, "worker %d round %ld", idx, round);
+  int errors = co_await pmss::write(buf, 4096, idx * 4096) != 0;
+  memset(buf, 0, 4096);
+  errors += co_await pmss::read(buf, 4096, idx * 4096) != 0;
+  char expect[64];
+  snprintf(expect, sizeof(expect), "worker %d round %ld", idx, round);
+  errors += strcmp(buf, expect) != 0;
+  co_return errors;
+}
+
+// 不依赖调度器：spdk_thread自己把cpumask改成只有另一个核，
+// reactor在这一轮poll之后就把它移过去。迁移前后编号、io channel都不变，
+// I/O照常完成。返回值：1表示迁移成功并且I/O都正确，主线程不迁移返回0
+task<int> forced_move(int idx) {
+  int worker = pmss::worker_index();
+  EXPECT_TRUE(worker == idx);
+  if (pmss::workers[worker].thread == pmss::main_thread)
+    co_return 0;
+  spdk_io_channel* channel = pmss::local_worker().channel;
+  char* buf = (char*)spdk_dma_zmalloc(4096, 4096, nullptr);
+  int errors = co_await io_round(idx, -1, buf);
+
+  uint32_t from = spdk_env_get_current_core();
+  uint32_t to = from == pmss::reactor_cores[0] ? pmss::reactor_cores[1]
+                                               : pmss::reactor_cores[0];
+  spdk_cpuset mask;
+  spdk_cpuset_zero(&mask);
+  spdk_cpuset_set_cpu(&mask, to, true);
+  EXPECT_TRUE(spdk_thread_set_cpumask(&mask) == 0);
+  // 只是防止迁移失败时测试一直挂着
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+  while (spdk_env_get_current_core() != to &&
+         std::chrono::steady_clock::now() < deadline)
+    co_await yield();
+  bool moved = spdk_env_get_current_core() == to;
+  EXPECT_TRUE(moved);
+
+  // 迁移不改变spdk_thread，编号和io channel也不变
+  EXPECT_TRUE(pmss::worker_index() == worker);
+  EXPECT_TRUE(pmss::local_worker().channel == channel);
+  for (long i = 0; i < n_round_after_move; ++i) {
+    errors += co_await io_round(idx, i, buf);
+    if (i % 16 == 0)
+      co_await yield();
+    EXPECT_TRUE(spdk_env_get_current_core() == to);
+  }
+  spdk_dma_free(buf);
+  EXPECT_TRUE(errors == 0);
+  co_return moved && errors == 0;
+}
+
+TEST(thread_migration, forced_move_keeps_worker_and_channel) {
+  pmss::service_options opts =
+      pmss::default_options(n_reactor, json_file, bdev_dev);
+  opts.threads_per_core = threads_per_core;
+  pmss::init_service(opts);
+  EXPECT_TRUE(pmss::num_workers == n_worker);
+
+  std::vector<task<int>> ts;
+  for (int i = 0; i < n_worker; ++i)
+    ts.push_back(forced_move(i));
+  auto results = pmss::run_all(ts);
+  pmss::deinit_service();
+
+  // 除了主线程都迁移了
+  int moved = 0;
+  for (int i = 0; i < n_worker; ++i) {
+    EXPECT_TRUE(results[i].has_value());
+    moved += results[i].value_or(0);
+  }
+  EXPECT_TRUE(moved == n_worker - 1);
+}
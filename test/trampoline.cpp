@@ -0,0 +1,62 @@
+#include "mutex.hpp"
+#include "schedule.hpp"
+#include "task.hpp"
+#include <gtest/gtest.h>
+#include "common.hpp"
+
+const long n_completion = 1000000;
+const int n_waiter = 1000;
+const int n_round = 100;
+
+// 模拟同步完成的I/O：在await_suspend里直接调用完成回调
+struct sync_completion {
+  bool await_ready() const noexcept { return false; }
+  void await_suspend(std::coroutine_handle<> h) noexcept {
+    pmss::trampoline_resume(h);
+  }
+  void await_resume() noexcept {}
+};
+
+long completed = 0;
+
+task<int> leaf(long i) {
+  co_await sync_completion{};
+  co_return i & 1;
+}
+
+// 不经过trampoline的话每次完成都会在栈上多一层resume()
+task<int> chain() {
+  long odd = 0;
+  for (long i = 0; i < n_completion; ++i) {
+    co_await sync_completion{};
+    odd += co_await leaf(i);
+    ++completed;
+  }
+  EXPECT_TRUE(odd == n_completion / 2);
+  co_return 0;
+}
+
+// 同一个核上很多协程排队等锁，unlock直接在当前线程唤醒下一个，形成很长的唤醒链
+async_simple::coro::Mutex mutex(false);
+long counter = 0;
+
+task<int> contender() {
+  for (int i = 0; i < n_round; ++i) {
+    co_await mutex.coLock();
+    ++counter;
+    co_await sync_completion{};
+    mutex.unlock();
+  }
+  co_return 0;
+}
+
+TEST(trampoline, bounded_stack) {
+  pmss::init_service(1, json_file, bdev_dev);
+  pmss::add_task(chain());
+  for (int i = 0; i < n_waiter; ++i)
+    pmss::add_task(contender());
+  pmss::run();
+  pmss::deinit_service();
+  EXPECT_TRUE(completed == n_completion);
+  EXPECT_TRUE(counter == (long)n_waiter * n_round);
+}